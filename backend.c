@@ -0,0 +1,184 @@
+/*
+ * ssh-pageant backend dispatch.
+ * Copyright (C) 2026  Josh Stone
+ *
+ * This file is part of ssh-pageant, and is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General
+ * Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ */
+
+#include "compat.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "backend.h"
+#include "extension.h"
+#include "winpgntc.h"
+
+// The concurrency limit follows AIMD: it grows by one after a full limit's
+// worth of requests completes while saturated, and shrinks by a quarter
+// whenever a request fails or the smoothed latency gets much longer than the
+// recent best, which is tracked as the fastest request of each window.  Some
+// slack keeps timer noise on very fast requests from counting as a slowdown.
+// Latency is tracked per message type, since listing identities is much
+// cheaper than signing and would otherwise set an unreachable baseline.
+#define BACKEND_WINDOW     100
+#define BACKEND_TOLERANCE  2
+#define BACKEND_SLACK_USEC 100
+
+struct backend_latency {
+    unsigned long base_usec, window_usec;
+    long avg_usec;
+    int samples;
+};
+
+
+static pthread_mutex_t backend_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t backend_cond = PTHREAD_COND_INITIALIZER;
+
+static struct backend_job *backend_head = NULL, **backend_tail = &backend_head;
+
+static int backend_max = 1, backend_verbose = 0;
+static int backend_limit = 1, backend_inflight = 0, backend_growth = 0;
+static struct backend_latency backend_latency[256];
+
+
+static unsigned long
+now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+
+// Adjust the limit for one completed request of the given message type.
+// Called with backend_lock held.
+static void
+backend_update(unsigned char type, unsigned long usec, int failed)
+{
+    struct backend_latency *l = &backend_latency[type];
+    int limit = backend_limit;
+
+    if (!l->samples++ || usec < l->window_usec)
+        l->window_usec = usec;
+    if (!l->base_usec || l->window_usec < l->base_usec)
+        l->base_usec = l->window_usec;
+    if (l->samples == BACKEND_WINDOW) {
+        // Let the baseline drift up again if the backend got slower overall.
+        l->base_usec = l->window_usec;
+        l->samples = 0;
+    }
+
+    if (!l->avg_usec)
+        l->avg_usec = usec;
+    l->avg_usec += ((long)usec - l->avg_usec) / 4;
+
+    if (failed || (unsigned long)l->avg_usec
+            > BACKEND_TOLERANCE * l->base_usec + BACKEND_SLACK_USEC) {
+        limit -= (limit + 3) / 4;
+        backend_growth = 0;
+    }
+    else if (backend_inflight >= limit && ++backend_growth >= limit) {
+        ++limit;
+        backend_growth = 0;
+    }
+
+    if (limit < 1)
+        limit = 1;
+    if (limit > backend_max)
+        limit = backend_max;
+
+    if (limit != backend_limit) {
+        if (backend_verbose)
+            warnx("backend limit %d -> %d (type %d: %ld us, best %lu us)",
+                  backend_limit, limit, type, l->avg_usec, l->base_usec);
+        backend_limit = limit;
+        pthread_cond_broadcast(&backend_cond);
+    }
+}
+
+
+int
+backend_call(void *buf)
+{
+    unsigned char type = ((unsigned char *)buf)[4];
+    unsigned long start = now_usec();
+    int failed = agent_query(buf) < 0;
+
+    pthread_mutex_lock(&backend_lock);
+    backend_update(type, now_usec() - start, failed);
+    pthread_mutex_unlock(&backend_lock);
+    return failed ? -1 : 0;
+}
+
+
+void
+backend_query(void *buf, int len)
+{
+    if (!extension_query(buf, len))
+        backend_call(buf);
+}
+
+
+// Each backend thread takes queued jobs whenever fewer than the limit are
+// in flight, so only these threads ever wait on Pageant.
+static void *
+backend_thread(void *arg __attribute__((unused)))
+{
+    struct backend_job *job;
+
+    pthread_mutex_lock(&backend_lock);
+    for (;;) {
+        while (!backend_head || backend_inflight >= backend_limit)
+            pthread_cond_wait(&backend_cond, &backend_lock);
+        job = backend_head;
+        backend_head = job->next;
+        if (!backend_head)
+            backend_tail = &backend_head;
+        ++backend_inflight;
+        pthread_mutex_unlock(&backend_lock);
+
+        backend_query(job->buf, job->len);
+        job->done(job);
+
+        pthread_mutex_lock(&backend_lock);
+        --backend_inflight;
+        if (backend_head)
+            pthread_cond_signal(&backend_cond);
+    }
+    return NULL;
+}
+
+
+int
+backend_init(int max, int verbose)
+{
+    pthread_t thread;
+    int i;
+
+    backend_max = max > 0 ? max : 1;
+    backend_verbose = verbose;
+    for (i = 0; i < backend_max; ++i) {
+        errno = pthread_create(&thread, NULL, backend_thread, NULL);
+        if (errno)
+            return -1;
+    }
+    return 0;
+}
+
+
+void
+backend_submit(struct backend_job *job)
+{
+    job->next = NULL;
+    pthread_mutex_lock(&backend_lock);
+    *backend_tail = job;
+    backend_tail = &job->next;
+    pthread_cond_signal(&backend_cond);
+    pthread_mutex_unlock(&backend_lock);
+}
@@ -0,0 +1,39 @@
+/*
+ * ssh-pageant backend dispatch header.
+ * Copyright (C) 2026  Josh Stone
+ *
+ * This file is part of ssh-pageant, and is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General
+ * Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ */
+
+#ifndef __BACKEND_H__
+#define __BACKEND_H__
+
+// A request of len bytes in buf, queued with backend_submit().  The reply
+// replaces the request in buf, and then done is called on a backend thread.
+struct backend_job {
+    struct backend_job *next;
+    void *buf;
+    int len;
+    void (*done)(struct backend_job *job);
+};
+
+// Start max backend threads, allowing up to max concurrent Pageant requests,
+// and log limit changes if verbose.  Returns -1 with errno set if the threads
+// couldn't be started.  Without this, requests can only be made one at a
+// time with backend_query().
+extern int backend_init(int max, int verbose);
+
+// Queue a request for the backend threads, returning at once.
+extern void backend_submit(struct backend_job *job);
+
+// Answer a request of len bytes on this thread, replacing it in buf.
+extern void backend_query(void *buf, int len);
+
+// Make one Pageant round trip for buf, timing it for the concurrency limit.
+// Returns -1 if Pageant couldn't be reached.
+extern int backend_call(void *buf);
+
+#endif /* __BACKEND_H__ */
@@ -0,0 +1,265 @@
+/*
+ * ssh-pageant load generator.
+ * Copyright (C) 2026  Josh Stone
+ *
+ * This file is part of ssh-pageant, and is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General
+ * Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Runs several client threads against an agent socket, each repeatedly
+ * sending SSH_AGENTC_REQUEST_IDENTITIES and waiting for the answer, and
+ * reports the overall request rate.  Comparing runs against ssh-pageant with
+ * different -j settings shows how the I/O threads scale.  With -r, each
+ * client reconnects after that many requests, and -r 1 makes a storm of
+ * short connections that measures how fast the agent accepts them.  With -T,
+ * it connects to ssh-pageant --tcp instead, sending the token from -k first,
+ * so a relay in front of the UNIX-domain socket can be compared against it.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+struct client {
+    pthread_t thread;
+    unsigned long requests, connections, failures;
+};
+
+static const char *sockpath;
+static struct addrinfo *tcp_addr = NULL;
+static unsigned char token[260];
+static size_t token_len = 0;
+static int per_connection = 0;
+static volatile int running = 1;
+
+
+static int
+tcp_connect(void)
+{
+    int on = 1;
+    int fd = socket(tcp_addr->ai_family, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if (connect(fd, tcp_addr->ai_addr, tcp_addr->ai_addrlen) < 0
+            || (token_len && send(fd, token, token_len, MSG_NOSIGNAL)
+                             != (ssize_t)token_len)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+static int
+agent_connect(void)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int fd;
+
+    if (tcp_addr)
+        return tcp_connect();
+
+    fd = socket(PF_LOCAL, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    strncpy(addr.sun_path, sockpath, sizeof(addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+// Resolve a HOST:PORT argument for -T.
+static void
+resolve(const char *arg)
+{
+    struct addrinfo hints = { .ai_family = AF_UNSPEC,
+                              .ai_socktype = SOCK_STREAM };
+    char host[256];
+    const char *colon = strrchr(arg, ':');
+    int res;
+
+    if (!colon || (size_t)(colon - arg) >= sizeof(host))
+        errx(1, "%s: expected HOST:PORT", arg);
+    memcpy(host, arg, colon - arg);
+    host[colon - arg] = '\0';
+    res = getaddrinfo(host, colon + 1, &hints, &tcp_addr);
+    if (res)
+        errx(1, "%s: %s", arg, gai_strerror(res));
+}
+
+
+// Read the token from the first line of path, framed like an agent message.
+static void
+read_token(const char *path)
+{
+    char line[256];
+    size_t len;
+    FILE *f = fopen(path, "r");
+
+    if (!f || !fgets(line, sizeof(line), f))
+        err(1, "%s", path);
+    fclose(f);
+    len = strcspn(line, "\r\n");
+    token[0] = token[1] = 0;
+    token[2] = len >> 8;
+    token[3] = len & 0xff;
+    memcpy(token + 4, line, len);
+    token_len = 4 + len;
+}
+
+
+// Send one request and read back the complete reply.
+static int
+round_trip(int fd)
+{
+    static const char query[5] = { 0, 0, 0, 1, 11 };
+    unsigned char buf[8192];
+    size_t got = 0, need = 4;
+
+    if (send(fd, query, sizeof(query), MSG_NOSIGNAL) != sizeof(query))
+        return -1;
+
+    while (got < need) {
+        ssize_t n = recv(fd, buf + got, sizeof(buf) - got, 0);
+        if (n <= 0)
+            return -1;
+        got += n;
+        if (got >= 4)
+            need = 4 + ((size_t)buf[0] << 24 | buf[1] << 16
+                        | buf[2] << 8 | buf[3]);
+        if (need > sizeof(buf))
+            return -1;
+    }
+    return 0;
+}
+
+
+static void *
+client_thread(void *arg)
+{
+    struct client *c = arg;
+    int fd = -1, sent = 0;
+
+    while (running) {
+        if (fd < 0) {
+            if ((fd = agent_connect()) < 0) {
+                ++c->failures;
+                continue;
+            }
+            ++c->connections;
+            sent = 0;
+        }
+
+        if (round_trip(fd) < 0) {
+            ++c->failures;
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        ++c->requests;
+
+        if (per_connection && ++sent == per_connection) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    if (fd >= 0)
+        close(fd);
+    return NULL;
+}
+
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [-c CLIENTS] [-t SECONDS] [-r REQUESTS] [SOCKET]\n"
+            "       %s [-c CLIENTS] [-t SECONDS] [-r REQUESTS] -T HOST:PORT"
+            " [-k TOKEN_FILE]\n", name, name);
+    exit(1);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    unsigned long requests = 0, connections = 0, failures = 0;
+    struct client *clients;
+    struct timespec start, end;
+    double elapsed;
+    int i, opt, nclients = 8, seconds = 5;
+
+    while ((opt = getopt(argc, argv, "c:t:r:T:k:")) != -1)
+        switch (opt) {
+            case 'c':
+                nclients = atoi(optarg);
+                break;
+            case 't':
+                seconds = atoi(optarg);
+                break;
+            case 'r':
+                per_connection = atoi(optarg);
+                if (per_connection < 1)
+                    usage(argv[0]);
+                break;
+            case 'T':
+                resolve(optarg);
+                break;
+            case 'k':
+                read_token(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+
+    sockpath = optind < argc ? argv[optind] : getenv("SSH_AUTH_SOCK");
+    if ((!sockpath && !tcp_addr) || nclients < 1 || seconds < 1)
+        usage(argv[0]);
+
+    clients = calloc(nclients, sizeof(*clients));
+    if (!clients)
+        err(1, "calloc");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nclients; ++i) {
+        errno = pthread_create(&clients[i].thread, NULL,
+                               client_thread, &clients[i]);
+        if (errno)
+            err(1, "pthread_create");
+    }
+
+    sleep(seconds);
+    running = 0;
+
+    for (i = 0; i < nclients; ++i) {
+        pthread_join(clients[i].thread, NULL);
+        requests += clients[i].requests;
+        connections += clients[i].connections;
+        failures += clients[i].failures;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%d clients: %lu requests in %.2f s, %.0f/s, %lu failures\n",
+           nclients, requests, elapsed, requests / elapsed, failures);
+    printf("%lu connections, %.0f/s\n", connections, connections / elapsed);
+    return 0;
+}
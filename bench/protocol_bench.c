@@ -0,0 +1,204 @@
+/*
+ * ssh-pageant agent protocol microbenchmark.
+ * Copyright (C) 2026  Josh Stone
+ *
+ * This file is part of ssh-pageant, and is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General
+ * Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Times the protocol.c parsers on typical messages of each type the daemon
+ * looks into: an identities answer, a sign request, and a sign-batch
+ * extension, each sized like RSA-4096 keys.  Reports the time per message,
+ * which should stay far below one round trip to Pageant.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "extension.h"
+#include "protocol.h"
+
+#define KEY_LEN   535   // an ssh-rsa public key blob with a 4096-bit modulus
+#define DATA_LEN  256
+#define NKEYS     8
+#define BATCH     10
+
+typedef int (*parse_fn)(const unsigned char *msg, int len);
+
+static volatile uint32_t sink;
+
+
+static int
+build_identities(unsigned char *buf)
+{
+    unsigned char key[KEY_LEN] = { 0 };
+    const unsigned char *end = buf + AGENT_MAX_MSGLEN;
+    unsigned char *o = buf + 4;
+    int i;
+
+    msg_put_byte(&o, end, SSH_AGENT_IDENTITIES_ANSWER);
+    msg_put_u32(&o, end, NKEYS);
+    for (i = 0; i < NKEYS; ++i) {
+        msg_put_string(&o, end, key, sizeof(key));
+        msg_put_string(&o, end, "user@host", 9);
+    }
+    return msg_finish(buf, o);
+}
+
+
+static unsigned char *
+put_sign_request(unsigned char *o, const unsigned char *end)
+{
+    unsigned char key[KEY_LEN] = { 0 }, data[DATA_LEN] = { 0 };
+    msg_put_byte(&o, end, SSH2_AGENTC_SIGN_REQUEST);
+    msg_put_string(&o, end, key, sizeof(key));
+    msg_put_string(&o, end, data, sizeof(data));
+    msg_put_u32(&o, end, 0);
+    return o;
+}
+
+
+static int
+build_sign_request(unsigned char *buf)
+{
+    return msg_finish(buf, put_sign_request(buf + 4, buf + AGENT_MAX_MSGLEN));
+}
+
+
+static int
+build_sign_batch(unsigned char *buf)
+{
+    unsigned char req[AGENT_MAX_MSGLEN];
+    const unsigned char *end = buf + AGENT_MAX_MSGLEN;
+    unsigned char *o = buf + 4;
+    int i, len = put_sign_request(req, req + sizeof(req)) - req;
+
+    msg_put_byte(&o, end, SSH_AGENTC_EXTENSION);
+    msg_put_string(&o, end, EXTENSION_SIGN_BATCH, strlen(EXTENSION_SIGN_BATCH));
+    msg_put_u32(&o, end, BATCH);
+    for (i = 0; i < BATCH; ++i)
+        if (msg_put_string(&o, end, req, len) < 0)
+            errx(1, "sign-batch: %d requests don't fit", BATCH);
+    return msg_finish(buf, o);
+}
+
+
+static int
+parse_identities(const unsigned char *msg, int len)
+{
+    struct msg_view v;
+    struct msg_blob key, comment;
+    uint32_t n;
+
+    if (msg_open(&v, msg, len) != SSH_AGENT_IDENTITIES_ANSWER
+            || msg_get_identities(&v, &n) < 0)
+        return -1;
+    while (n-- > 0)
+        if (msg_next_identity(&v, &key, &comment) < 0)
+            return -1;
+        else
+            sink += key.len;
+    return 0;
+}
+
+
+static int
+parse_sign_request(const unsigned char *msg, int len)
+{
+    struct msg_view v;
+    struct msg_sign_request req;
+
+    if (msg_open(&v, msg, len) != SSH2_AGENTC_SIGN_REQUEST
+            || msg_get_sign_request(&v, &req) < 0)
+        return -1;
+    sink += req.data.len;
+    return 0;
+}
+
+
+static int
+parse_sign_batch(const unsigned char *msg, int len)
+{
+    struct msg_view v;
+    struct msg_blob name, inner;
+    struct msg_sign_request req;
+    uint32_t n;
+
+    if (msg_open(&v, msg, len) != SSH_AGENTC_EXTENSION
+            || msg_get_string(&v, &name) < 0
+            || !msg_blob_eq(&name, EXTENSION_SIGN_BATCH)
+            || msg_get_u32(&v, &n) < 0)
+        return -1;
+    while (n-- > 0) {
+        struct msg_view w;
+        if (msg_get_string(&v, &inner) < 0 || inner.len < 1)
+            return -1;
+        w.p = inner.p + 1;
+        w.end = inner.p + inner.len;
+        if (msg_get_sign_request(&w, &req) < 0)
+            return -1;
+        sink += req.data.len;
+    }
+    return 0;
+}
+
+
+static void
+run(const char *name, int (*build)(unsigned char *), parse_fn parse,
+    long iterations)
+{
+    unsigned char buf[AGENT_MAX_MSGLEN];
+    struct timespec start, end;
+    double elapsed;
+    long i;
+    int len = build(buf);
+
+    if (parse(buf, len) < 0)
+        errx(1, "%s: parse failed", name);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iterations; ++i)
+        parse(buf, len);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%-18s %5d bytes  %8.1f ns/msg  %8.1f MB/s\n", name, len,
+           elapsed * 1e9 / iterations, len * iterations / elapsed / 1e6);
+}
+
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n ITERATIONS]\n", name);
+    exit(1);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    long iterations = 1000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1)
+        switch (opt) {
+            case 'n':
+                iterations = atol(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    if (iterations < 1)
+        usage(argv[0]);
+
+    run("identities-answer", build_identities, parse_identities, iterations);
+    run("sign-request", build_sign_request, parse_sign_request, iterations);
+    run("sign-batch", build_sign_batch, parse_sign_batch, iterations);
+    return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * ssh-pageant startup benchmark.
+ * Copyright (C) 2026  Josh Stone
+ *
+ * This file is part of ssh-pageant, and is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General
+ * Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Times wrapping a trivial command with ssh-pageant, once with a private
+ * agent started for each run, and once attached to a shared agent with -r,
+ * to show what each wrapped command pays for its agent.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+
+static pid_t
+start(char *const argv[], int quiet)
+{
+    posix_spawn_file_actions_t actions;
+    pid_t pid;
+
+    posix_spawn_file_actions_init(&actions);
+    if (quiet)
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null",
+                                         O_WRONLY, 0);
+    errno = posix_spawn(&pid, argv[0], &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (errno)
+        err(1, "%s", argv[0]);
+    return pid;
+}
+
+
+static void
+run(char *const argv[])
+{
+    int status;
+    pid_t pid = start(argv, 0);
+    if (waitpid(pid, &status, 0) < 0)
+        err(1, "waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        errx(1, "%s failed", argv[0]);
+}
+
+
+// Run argv the given number of times, returning the mean seconds per run.
+static double
+time_runs(char *const argv[], int runs)
+{
+    struct timespec start, end;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < runs; ++i)
+        run(argv);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return ((end.tv_sec - start.tv_sec)
+            + (end.tv_nsec - start.tv_nsec) / 1e9) / runs;
+}
+
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n RUNS] [PROGRAM]\n", name);
+    exit(1);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    char dir[] = "/tmp/ssh-pageant-bench.XXXXXX";
+    char sockpath[64];
+    char *program = "./ssh-pageant.exe";
+    double private_sec, shared_sec;
+    struct stat st;
+    pid_t agent;
+    int i, opt, runs = 100;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1)
+        switch (opt) {
+            case 'n':
+                runs = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+
+    if (optind < argc)
+        program = argv[optind];
+    if (runs < 1)
+        usage(argv[0]);
+
+    if (!mkdtemp(dir))
+        err(1, "mkdtemp");
+    snprintf(sockpath, sizeof(sockpath), "%s/agent", dir);
+
+    char *private_argv[] = { program, "-q", "true", NULL };
+    char *agent_argv[] = { program, "-d", "-q", "-a", sockpath, NULL };
+    char *shared_argv[] = { program, "-q", "-r", "-a", sockpath, "true", NULL };
+
+    private_sec = time_runs(private_argv, runs);
+
+    // Start the shared agent up front, so every run measures attaching.
+    agent = start(agent_argv, 1);
+    for (i = 0; stat(sockpath, &st) < 0; ++i) {
+        if (i == 1000)
+            errx(1, "%s: agent didn't start", sockpath);
+        usleep(1000);
+    }
+    shared_sec = time_runs(shared_argv, runs);
+    kill(agent, SIGTERM);
+    waitpid(agent, NULL, 0);
+    rmdir(dir);
+
+    printf("private agent: %.2f ms per command\n", private_sec * 1e3);
+    printf("shared agent:  %.2f ms per command\n", shared_sec * 1e3);
+    return 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * ssh-pageant agent client.
+ * Copyright (C) 2026  Josh Stone
+ *
+ * This file is part of ssh-pageant, and is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General
+ * Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ */
+
+#include "compat.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "client.h"
+#include "extension.h"
+#include "protocol.h"
+
+// At most this many requests go in one batch, and fewer once the agent has
+// answered only part of a batch because the replies didn't fit.
+#define BATCH_MAX  64
+
+
+int
+client_connect(const char *sockpath)
+{
+    struct sockaddr_un addr;
+    int fd = socket(PF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    addr.sun_family = AF_UNIX;
+    strlcpy(addr.sun_path, sockpath, sizeof(addr.sun_path));
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+int
+client_send(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+
+int
+client_recv(int fd, void *buf)
+{
+    int len, got = 0;
+    while ((len = msg_frame(buf, got)) == 0) {
+        ssize_t n = recv(fd, (char *)buf + got, AGENT_MAX_MSGLEN - got, 0);
+        if (n <= 0)
+            return -1;
+        got += n;
+    }
+    return len;
+}
+
+
+// Read one length-prefixed message from a stream.  Returns its length,
+// 0 at a clean end of input, or -1.
+static int
+read_msg(FILE *f, unsigned char *buf)
+{
+    int len;
+    size_t n = fread(buf, 1, 4, f);
+    if (n == 0 && feof(f))
+        return 0;
+    if (n < 4 || msg_frame(buf, 4) < 0)
+        return -1;
+    len = 4 + msg_load_u32(buf);
+    if (fread(buf + 4, 1, len - 4, f) != (size_t)len - 4)
+        return -1;
+    return len;
+}
+
+
+// Ask the agent for each request on its own, as a fallback for agents that
+// don't know sign-batch@ssh-pageant.
+static int
+sign_each(int fd, unsigned char **reqs, int n)
+{
+    unsigned char buf[AGENT_MAX_MSGLEN];
+    int i, len;
+    for (i = 0; i < n; ++i) {
+        if (client_send(fd, reqs[i], msg_frame(reqs[i], AGENT_MAX_MSGLEN)) < 0
+                || (len = client_recv(fd, buf)) < 0
+                || fwrite(buf, len, 1, stdout) != 1)
+            return -1;
+    }
+    return 0;
+}
+
+
+// Sign one batch.  The agent answers only as many requests as it can fit
+// the replies of into one message, so send the rest again until all are
+// done, and make later batches no larger than what was answered.
+static int
+sign_batch(int fd, unsigned char **reqs, int n, int *max)
+{
+    unsigned char buf[AGENT_MAX_MSGLEN];
+    const unsigned char *end = buf + sizeof(buf);
+    struct msg_view v;
+    struct msg_blob reply;
+    uint32_t count;
+    int i, len;
+
+    while (n > 0) {
+        unsigned char *o = buf + 4;
+        msg_put_byte(&o, end, SSH_AGENTC_EXTENSION);
+        msg_put_string(&o, end, EXTENSION_SIGN_BATCH,
+                       strlen(EXTENSION_SIGN_BATCH));
+        msg_put_u32(&o, end, n);
+        for (i = 0; i < n; ++i)
+            if (msg_put_string(&o, end, reqs[i] + 4,
+                               msg_frame(reqs[i], AGENT_MAX_MSGLEN) - 4) < 0)
+                return -1;
+
+        if (client_send(fd, buf, msg_finish(buf, o)) < 0
+                || (len = client_recv(fd, buf)) < 0)
+            return -1;
+
+        // Anything else, such as a failure from an agent that doesn't know
+        // the extension, falls back to plain requests.
+        if (msg_open(&v, buf, len) != SSH_AGENT_SUCCESS)
+            return sign_each(fd, reqs, n);
+
+        if (msg_get_u32(&v, &count) < 0 || count > (uint32_t)n)
+            return -1;
+        for (i = 0; i < (int)count; ++i) {
+            unsigned char prefix[4];
+            unsigned char *p = prefix;
+            if (msg_get_string(&v, &reply) < 0)
+                return -1;
+            msg_put_u32(&p, prefix + 4, reply.len);
+            if (fwrite(prefix, 4, 1, stdout) != 1
+                    || fwrite(reply.p, reply.len, 1, stdout) != 1)
+                return -1;
+        }
+
+        // A reply too large to batch at all still fits a plain request.
+        if (count == 0) {
+            if (sign_each(fd, reqs, 1) < 0)
+                return -1;
+            count = 1;
+        }
+        else if ((int)count < n && (int)count < *max)
+            *max = count;
+        reqs += count;
+        n -= count;
+    }
+    return 0;
+}
+
+
+int
+client_sign_batch(const char *sockpath)
+{
+    unsigned char *reqs[BATCH_MAX];
+    int i, n = 0, size = 0, len = 0, max = BATCH_MAX, res = -1;
+
+    int fd = client_connect(sockpath);
+    if (fd < 0) {
+        warn("connect(%s)", sockpath);
+        return -1;
+    }
+
+    do {
+        unsigned char *req = NULL;
+        if (n < max) {
+            req = malloc(AGENT_MAX_MSGLEN);
+            if (!req) {
+                warnx("malloc: No memory");
+                goto out;
+            }
+            len = read_msg(stdin, req);
+            if (len < 0 || (len > 0 && req[4] != SSH2_AGENTC_SIGN_REQUEST)) {
+                warnx("stdin: expected a sign request message");
+                free(req);
+                goto out;
+            }
+            if (len == 0) {
+                free(req);
+                req = NULL;
+            }
+        }
+
+        // Send what's pending once the batch is full, the next request
+        // wouldn't fit in the same frame, or the input is done.
+        if (n > 0 && (!req || n == max
+                      || size + len + 64 > AGENT_MAX_MSGLEN)) {
+            if (sign_batch(fd, reqs, n, &max) < 0) {
+                warnx("sign-batch: agent failed");
+                free(req);
+                goto out;
+            }
+            for (i = 0; i < n; ++i)
+                free(reqs[i]);
+            n = size = 0;
+        }
+
+        if (req) {
+            reqs[n++] = req;
+            size += len;
+        }
+    } while (len > 0 || n > 0);
+
+    res = fflush(stdout) == 0 ? 0 : -1;
+
+out:
+    for (i = 0; i < n; ++i)
+        free(reqs[i]);
+    close(fd);
+    return res;
+}
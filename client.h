@@ -0,0 +1,31 @@
+/*
+ * ssh-pageant agent client header.
+ * Copyright (C) 2026  Josh Stone
+ *
+ * This file is part of ssh-pageant, and is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General
+ * Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ */
+
+#ifndef __CLIENT_H__
+#define __CLIENT_H__
+
+#include <stddef.h>
+
+// Connect to the agent socket at sockpath.
+extern int client_connect(const char *sockpath);
+
+// Send all of buf, retrying short writes.
+extern int client_send(int fd, const void *buf, size_t len);
+
+// Read one complete agent message into buf, which must hold
+// AGENT_MAX_MSGLEN bytes.  Returns its length, or -1.
+extern int client_recv(int fd, void *buf);
+
+// Read SSH2_AGENTC_SIGN_REQUEST messages from stdin, each with its length
+// prefix, and sign them through sign-batch@ssh-pageant at sockpath.  The
+// replies are written to stdout in the same order and framing.
+extern int client_sign_batch(const char *sockpath);
+
+#endif /* __CLIENT_H__ */
@@ -35,7 +35,8 @@
 // MSYS doesn't have program_invocation_short_name.
 // Take the easy way out and hard-code it.
 static char ssh_pageant_name[] = "ssh-pageant";
-static char *program_invocation_short_name = ssh_pageant_name;
+static char *program_invocation_short_name __attribute__((unused))
+    = ssh_pageant_name;
 
 // MSYS doesn't have a BSD err.h at all, but it's easy to approximate.
 // These are simplified by assuming a string-literal fmt, never NULL.
@@ -49,7 +50,7 @@ static char *program_invocation_short_name = ssh_pageant_name;
     fprintf(stderr, "%s: " fmt "\n", program_invocation_short_name, ##args)
 
 // MSYS doesn't have mkdtemp, but mktemp+mkdir is probably fine.
-static char *
+static inline char *
 mkdtemp(char *template)
 {
     char *path = mktemp(template);
@@ -59,7 +60,7 @@ mkdtemp(char *template)
 }
 
 // MSYS doesn't have strlcpy, so guarantee strncpy is terminated.
-static size_t
+static inline size_t
 strlcpy(char *dst, const char *src, size_t size)
 {
     strncpy(dst, src, size);
@@ -68,25 +69,29 @@ strlcpy(char *dst, const char *src, size_t size)
     return strlen(src);
 }
 
-// MSYS doesn't have SOCK_CLOEXEC, so set it in a separate call.
+// MSYS doesn't have SOCK_CLOEXEC or SOCK_NONBLOCK, so set them in separate
+// calls.
+#define SOCK_NONBLOCK	0x01000000
 #define SOCK_CLOEXEC	0x02000000
 
-static int
+static inline int
 socket_ext(int domain, int type, int protocol)
 {
-    int fd = socket(domain, type & ~SOCK_CLOEXEC, protocol);
+    int fd = socket(domain, type & ~(SOCK_CLOEXEC | SOCK_NONBLOCK), protocol);
     if (fd >= 0 && type & SOCK_CLOEXEC)
         fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if (fd >= 0 && type & SOCK_NONBLOCK)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
     return fd;
 }
 #define socket(d, t, p)  socket_ext(d, t, p)
 
-static int
+static inline int
 accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags)
 {
     int fd;
 
-    if (flags & ~SOCK_CLOEXEC) {
+    if (flags & ~(SOCK_CLOEXEC | SOCK_NONBLOCK)) {
         errno = EINVAL;
         return -1;
     }
@@ -94,13 +99,42 @@ accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags)
     fd = accept(sockfd, addr, addrlen);
     if (fd >= 0 && flags & SOCK_CLOEXEC)
         fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if (fd >= 0 && flags & SOCK_NONBLOCK)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
     return fd;
 }
 
+// MSYS doesn't have pipe2 or O_CLOEXEC either.
+#ifndef O_CLOEXEC
+#define O_CLOEXEC	0x40000
+#endif
+
+static inline int
+pipe2(int fds[2], int flags)
+{
+    if (flags & ~O_CLOEXEC) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (pipe(fds) < 0)
+        return -1;
+    if (flags & O_CLOEXEC) {
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    }
+    return 0;
+}
+
+// MSYS doesn't have MSG_NOSIGNAL either, so SIGPIPE can't be avoided there.
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL	0
+#endif
+
 // MSYS only has the old path conversion APIs, which Cygwin has deprecated.
 #define CCP_WIN_A_TO_POSIX 2
 #define CCP_RELATIVE 0x100
-static ssize_t
+static inline ssize_t
 cygwin_conv_path (unsigned what, const void *from, void *to, size_t size)
 {
     char posix[MAX_PATH];
@@ -119,7 +153,7 @@ cygwin_conv_path (unsigned what, const void *from, void *to, size_t size)
     return -1;
 }
 
-static int
+static inline int
 path_is_socket(const char *path)
 {
     struct stat st;
@@ -157,7 +191,7 @@ path_is_socket(const char *path)
 #include <sys/types.h>
 
 
-static int
+static inline int
 path_is_socket(const char *path)
 {
     struct stat st;
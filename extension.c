@@ -0,0 +1,160 @@
+/*
+ * ssh-pageant agent extensions.
+ * Copyright (C) 2026  Josh Stone
+ *
+ * This file is part of ssh-pageant, and is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General
+ * Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ */
+
+#include <string.h>
+
+#include "backend.h"
+#include "extension.h"
+#include "protocol.h"
+
+
+static void
+reply_byte(void *buf, unsigned char type)
+{
+    const unsigned char reply[5] = { 0, 0, 0, 1, type };
+    memcpy(buf, reply, sizeof(reply));
+}
+
+
+// sign-batch@ssh-pageant carries many SSH2_AGENTC_SIGN_REQUEST messages in
+// one frame, so a client signing a lot pays for only one round trip:
+//
+//   request:  uint32 count, count * string sign-request-message
+//   reply:    byte SSH_AGENT_SUCCESS, uint32 done, done * string reply
+//
+// Each inner message is a complete agent message without its length prefix,
+// and each is answered by Pageant in order.  The replies must still fit in
+// AGENT_MAX_MSGLEN, so signing stops early once the next one might not, and
+// the client sends the remaining requests again.  A signature is about as
+// long as its key, so that plus some slack for the framing and algorithm name
+// is taken as the size of its reply.
+#define SIGN_REPLY_SLACK  64
+
+// Check that every request of a batch is a well-formed sign request through
+// to the end, before any of them is passed on.
+static int
+check_batch(struct msg_view req, uint32_t count)
+{
+    uint32_t i;
+
+    for (i = 0; i < count; ++i) {
+        struct msg_blob msg;
+        struct msg_view inner;
+        struct msg_sign_request sign;
+        if (msg_get_string(&req, &msg) < 0 || msg.len < 1
+                || msg.p[0] != SSH2_AGENTC_SIGN_REQUEST
+                || msg.len > AGENT_MAX_MSGLEN - 4)
+            return -1;
+
+        inner.p = msg.p + 1;
+        inner.end = msg.p + msg.len;
+        if (msg_get_sign_request(&inner, &sign) < 0 || inner.p != inner.end)
+            return -1;
+    }
+    return req.p == req.end ? 0 : -1;
+}
+
+
+static void
+sign_batch(void *buf, struct msg_view *req)
+{
+    unsigned char query[AGENT_MAX_MSGLEN];
+    unsigned char reply[AGENT_MAX_MSGLEN];
+    const unsigned char *end = reply + sizeof(reply);
+    unsigned char *o = reply + 4, *done;
+    uint32_t i, count;
+    int len;
+
+    if (msg_get_u32(req, &count) < 0 || check_batch(*req, count) < 0)
+        goto fail;
+
+    msg_put_byte(&o, end, SSH_AGENT_SUCCESS);
+    done = o;
+    msg_put_u32(&o, end, 0);
+
+    for (i = 0; i < count; ++i) {
+        struct msg_blob msg;
+        struct msg_view inner;
+        struct msg_sign_request sign;
+        unsigned char *q = query + 4;
+
+        msg_get_string(req, &msg);
+        inner.p = msg.p + 1;
+        inner.end = msg.p + msg.len;
+        msg_get_sign_request(&inner, &sign);
+        if ((size_t)(end - o) < 4 + sign.key.len + SIGN_REPLY_SLACK)
+            break;
+
+        memcpy(q, msg.p, msg.len);
+        msg_finish(query, q + msg.len);
+        backend_call(query);
+        len = msg_frame(query, sizeof(query));
+        if (len < 0)
+            goto fail;
+
+        // The estimate was short, so this reply is lost.
+        if (msg_put_string(&o, end, query + 4, len - 4) < 0)
+            break;
+    }
+
+    msg_put_u32(&done, done + 4, i);
+    memcpy(buf, reply, msg_finish(reply, o));
+    return;
+
+fail:
+    reply_byte(buf, SSH_AGENT_EXTENSION_FAILURE);
+}
+
+
+// Open an extension request, leaving req at the data after its name.
+static int
+open_extension(struct msg_view *req, struct msg_blob *name, void *buf, int len)
+{
+    return msg_open(req, buf, len) == SSH_AGENTC_EXTENSION
+        && msg_get_string(req, name) == 0;
+}
+
+
+int
+agent_extension(void *buf, int len)
+{
+    struct msg_view req;
+    struct msg_blob name;
+
+    if (!open_extension(&req, &name, buf, len))
+        return 0;
+
+    // ping@ssh-pageant is answered without involving Pageant at all, so it
+    // shows that the daemon itself is still serving requests.
+    if (msg_blob_eq(&name, EXTENSION_PING)) {
+        reply_byte(buf, SSH_AGENT_SUCCESS);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+int
+extension_query(void *buf, int len)
+{
+    struct msg_view req;
+    struct msg_blob name;
+
+    if (!open_extension(&req, &name, buf, len))
+        return 0;
+
+    if (msg_blob_eq(&name, EXTENSION_SIGN_BATCH)) {
+        sign_batch(buf, &req);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,28 @@
+/*
+ * ssh-pageant agent extensions header.
+ * Copyright (C) 2026  Josh Stone
+ *
+ * This file is part of ssh-pageant, and is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General
+ * Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ */
+
+#ifndef __EXTENSION_H__
+#define __EXTENSION_H__
+
+#define EXTENSION_PING        "ping@ssh-pageant"
+#define EXTENSION_SIGN_BATCH  "sign-batch@ssh-pageant"
+
+// Handle an extension request of len bytes in buf, which ssh-pageant
+// answers itself without Pageant, replacing it with the reply.  Returns 0 if
+// the request needs Pageant.
+extern int agent_extension(void *buf, int len);
+
+// Handle an extension request of len bytes in buf, which ssh-pageant
+// implements with its own series of Pageant requests, replacing it with the
+// reply.  This may take as long as Pageant does.  Returns 0 if the request
+// should instead be passed on to Pageant unchanged.
+extern int extension_query(void *buf, int len);
+
+#endif /* __EXTENSION_H__ */
@@ -0,0 +1,130 @@
+/*
+ * ssh-pageant agent protocol fuzzer.
+ * Copyright (C) 2026  Josh Stone
+ *
+ * This file is part of ssh-pageant, and is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General
+ * Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * A libFuzzer target for protocol.c.  The input is treated as a stream of
+ * agent messages, as a connection would deliver them, and each one is walked
+ * with the parsers for its type.  Sign requests are rebuilt with the msg_put
+ * helpers and must come out identical.  Any read outside the input is left
+ * for the sanitizers to catch.
+ */
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "extension.h"
+#include "protocol.h"
+
+#define CHECK(cond)  do { if (!(cond)) abort(); } while (0)
+
+
+static void
+check_blob(const struct msg_blob *b, const unsigned char *buf, int len)
+{
+    CHECK(b->p >= buf && b->p <= buf + len
+          && b->len <= (uint32_t)(buf + len - b->p));
+}
+
+
+static void
+check_sign_request(struct msg_view *v, const unsigned char *msg, int len)
+{
+    unsigned char out[AGENT_MAX_MSGLEN];
+    const unsigned char *end = out + sizeof(out);
+    unsigned char *o = out + 4;
+    struct msg_sign_request req;
+    const unsigned char *start = v->p;
+
+    if (msg_get_sign_request(v, &req) < 0) {
+        CHECK(v->p == start);
+        return;
+    }
+    check_blob(&req.key, msg, len);
+    check_blob(&req.data, msg, len);
+
+    CHECK(msg_put_byte(&o, end, SSH2_AGENTC_SIGN_REQUEST) == 0);
+    CHECK(msg_put_string(&o, end, req.key.p, req.key.len) == 0);
+    CHECK(msg_put_string(&o, end, req.data.p, req.data.len) == 0);
+    CHECK(msg_put_u32(&o, end, req.flags) == 0);
+    CHECK(!memcmp(out + 4, start - 1, o - (out + 4)));
+}
+
+
+static void
+walk_sign_batch(struct msg_view *v, const unsigned char *msg, int len)
+{
+    struct msg_blob inner;
+    uint32_t count;
+
+    if (msg_get_u32(v, &count) < 0)
+        return;
+    while (count-- > 0 && msg_get_string(v, &inner) == 0) {
+        struct msg_view w = { inner.p + 1, inner.p + inner.len };
+        check_blob(&inner, msg, len);
+        if (inner.len > 0 && inner.p[0] == SSH2_AGENTC_SIGN_REQUEST)
+            check_sign_request(&w, msg, len);
+    }
+}
+
+
+static void
+walk_message(const unsigned char *msg, int len)
+{
+    struct msg_view v;
+    struct msg_blob key, comment, name;
+    uint32_t n;
+    unsigned char byte;
+
+    int type = msg_open(&v, msg, len);
+    CHECK(type >= 0 && v.p == msg + 5 && v.end == msg + len);
+
+    switch (type) {
+        case SSH_AGENT_IDENTITIES_ANSWER:
+            if (msg_get_identities(&v, &n) == 0)
+                while (n-- > 0 && msg_next_identity(&v, &key, &comment) == 0) {
+                    check_blob(&key, msg, len);
+                    check_blob(&comment, msg, len);
+                }
+            break;
+
+        case SSH2_AGENTC_SIGN_REQUEST:
+            check_sign_request(&v, msg, len);
+            break;
+
+        case SSH_AGENTC_EXTENSION:
+            if (msg_get_string(&v, &name) == 0) {
+                check_blob(&name, msg, len);
+                if (msg_blob_eq(&name, EXTENSION_SIGN_BATCH))
+                    walk_sign_batch(&v, msg, len);
+            }
+            break;
+
+        default:
+            while (msg_get_byte(&v, &byte) == 0)
+                ;
+            break;
+    }
+    CHECK(v.p <= v.end);
+}
+
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    while (size > 0) {
+        int len = msg_frame(data, size > INT_MAX ? INT_MAX : (int)size);
+        if (len <= 0)
+            break;
+        walk_message(data, len);
+        data += len;
+        size -= len;
+    }
+    return 0;
+}
@@ -10,53 +10,119 @@
 
 #include "compat.h"
 
+#include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <process.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/cygwin.h>
-#include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "backend.h"
+#include "client.h"
+#include "extension.h"
+#include "protocol.h"
+#include "trace.h"
 #include "winpgntc.h"
 
 
-#define FD_FOREACH(fd, set) \
-    for (fd = 0; fd < FD_SETSIZE; ++fd) \
-        if (FD_ISSET(fd, set))
+// How long --reuse waits for an existing agent to answer its probe, unless
+// --reuse-timeout says otherwise.
+#define REUSE_PROBE_MSEC  1000
+
+// A sanity limit on -j.  Each thread costs an I/O thread and a backend
+// thread with their stacks and pipes, and more of them than this won't get
+// Pageant to answer any faster.
+#define MAX_THREADS  64
+
+// TCP connections that haven't sent the token yet are capped in number per
+// I/O thread, evicting the oldest to make room, and closed if they take too
+// long, so they can't tie up descriptors.
+#define PREAUTH_MAX  8
+#define PREAUTH_SEC  5
 
 typedef enum {BOURNE, C_SH, FISH} shell_type;
 
+// The backend job comes first, so a finished job leads back to its buffer.
 struct fd_buf {
-    int recv, send;
+    struct backend_job job;
+    struct reactor *reactor;
+    int fd;
+    unsigned id;
+    short events;
+    int need_token;
+    time_t token_deadline;
+    int recv, send, len;
     char buf[AGENT_MAX_MSGLEN];
 };
 
+// A listening socket, and whether its connections must first present the
+// pre-shared token.
+struct listener {
+    int fd;
+    int need_token;
+};
+
+// The connections of one I/O thread, with their buffers indexed by fd.
+// Each wants either POLLIN for a request or POLLOUT for its reply.
+struct reactor {
+    pthread_t thread;
+    int handoff[2], wake[2];
+    struct fd_buf **bufs;
+    int nbufs;
+    struct pollfd *pfds;
+    int npfds;
+    int npreauth;
+};
+
 
 static char cleanup_tempdir[UNIX_PATH_MAX] = "";
 static char cleanup_sockpath[UNIX_PATH_MAX] = "";
+static ino_t cleanup_sockino = 0;
+
+static char *auth_token = NULL;
+static size_t auth_token_len = 0;
+
+// A descriptor held in reserve, so the acceptor can still accept and drop a
+// connection when it runs out of descriptors, rather than spinning on it.
+static int spare_fd = -1;
 
 
 static void cleanup_exit(int status) __attribute__((noreturn));
 static void cleanup_warn(const char *prefix) __attribute__((noreturn, nonnull));
 static void cleanup_signal(int sig) __attribute__((noreturn));
 
-static void do_agent_loop(int sockfd) __attribute__((noreturn));
+static void reactor_run(struct reactor *r, const struct listener *ls, int nls)
+    __attribute__((noreturn));
+static void do_agent_loop(const struct listener *ls, int nls,
+                          int nthreads, int debug) __attribute__((noreturn));
 
 
 
 static void
 cleanup_exit(int status)
 {
-    unlink(cleanup_sockpath);
+    // A replacement daemon may have taken over the path by now, so only
+    // remove the socket if it's still the one we bound.
+    struct stat st;
+    if (!cleanup_sockino || (stat(cleanup_sockpath, &st) == 0
+                && st.st_ino == cleanup_sockino))
+        unlink(cleanup_sockpath);
     rmdir(cleanup_tempdir);
     exit(status);
 }
@@ -102,11 +168,31 @@ create_socket_path(char* sockpath, size_t len)
 }
 
 
+static int
+set_nonblock(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0)
+        return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+
+// Whether a failed accept, recv or send should just be retried later.
+static int
+io_retry(void)
+{
+    return errno == EAGAIN || errno == EWOULDBLOCK
+        || errno == EINTR || errno == ECONNABORTED;
+}
+
+
 // Prepare the socket at the given path.
 static int
 open_auth_socket(const char* sockpath)
 {
     struct sockaddr_un addr;
+    struct stat st;
     mode_t um;
     int fd;
 
@@ -121,28 +207,220 @@ open_auth_socket(const char* sockpath)
     addr.sun_family = AF_UNIX;
 
     um = umask(S_IXUSR | S_IRWXG | S_IRWXO);
-    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
-        cleanup_warn("bind");
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        if (errno != EADDRINUSE)
+            cleanup_warn("bind");
+        umask(um);
+        close(fd);
+        errno = EADDRINUSE;
+        return -1;
+    }
     umask(um);
 
     // NB: Don't set cleanup_sockpath until after it's bound
     strlcpy(cleanup_sockpath, sockpath, sizeof(cleanup_sockpath));
+    if (stat(sockpath, &st) == 0)
+        cleanup_sockino = st.st_ino;
 
     if (listen(fd, 128) < 0)
         cleanup_warn("listen");
 
+    if (set_nonblock(fd) < 0)
+        cleanup_warn("fcntl");
+
     return fd;
 }
 
 
-// Try to reuse an existing socket path.  For now, just being able to connect
-// will be deemed good enough.  If it can't connect, but is still a socket, try
-// to remove it.  Return 0 if the path was simply not connectible, else exit.
+// Parse a --tcp argument of the form [ADDR:]PORT, where ADDR is an IPv4
+// address that defaults to loopback.
 static int
-reuse_socket_path(const char* sockpath)
+parse_tcp_address(const char *arg, struct sockaddr_in *addr)
+{
+    char host[INET_ADDRSTRLEN];
+    const char *colon = strrchr(arg, ':');
+    char *end;
+    long port;
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (colon) {
+        if ((size_t)(colon - arg) >= sizeof(host))
+            return -1;
+        memcpy(host, arg, colon - arg);
+        host[colon - arg] = '\0';
+        if (inet_pton(AF_INET, host, &addr->sin_addr) != 1)
+            return -1;
+        arg = colon + 1;
+    }
+
+    port = strtol(arg, &end, 10);
+    if (end == arg || *end || port < 1 || port > 65535)
+        return -1;
+    addr->sin_port = htons(port);
+    return 0;
+}
+
+
+// Prepare a TCP socket on the given address, for clients such as VMs and
+// containers which can't reach the UNIX-domain socket.
+static int
+open_tcp_socket(const struct sockaddr_in *addr)
+{
+    int fd, on = 1;
+
+    fd = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        cleanup_warn("socket");
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0)
+        cleanup_warn("bind");
+
+    if (listen(fd, 128) < 0)
+        cleanup_warn("listen");
+
+    if (set_nonblock(fd) < 0)
+        cleanup_warn("fcntl");
+
+    return fd;
+}
+
+
+// Read the pre-shared token for TCP clients from the first line of a file.
+static void
+read_auth_token(const char *path)
+{
+    char line[256];
+    FILE *f = fopen(path, "r");
+    if (!f)
+        err(1, "%s", path);
+    if (!fgets(line, sizeof(line), f))
+        line[0] = '\0';
+    fclose(f);
+
+    line[strcspn(line, "\r\n")] = '\0';
+    if (!line[0])
+        errx(1, "%s: empty token", path);
+    auth_token = strdup(line);
+    if (!auth_token)
+        err(1, "strdup");
+    auth_token_len = strlen(auth_token);
+}
+
+
+// Compare a presented token without leaking how much of it matched.
+static int
+check_auth_token(const char *token, size_t len)
+{
+    unsigned char diff = len != auth_token_len;
+    size_t i;
+    for (i = 0; i < len && i < auth_token_len; ++i)
+        diff |= token[i] ^ auth_token[i];
+    return !diff;
+}
+
+
+static time_t
+monotonic_sec(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+
+// A connection no longer waits for its token, whether it sent it or closed.
+static void
+preauth_end(struct fd_buf *p)
+{
+    if (p->need_token) {
+        p->need_token = 0;
+        --p->reactor->npreauth;
+    }
+}
+
+
+// Check that the agent on a connected socket actually answers requests, not
+// just connections, by sending it a ping@ssh-pageant extension request.  An
+// older ssh-pageant passes that on to Pageant, whose failure reply proves it
+// alive just as well.  Return 1 if any reply arrives within msec, 0 if none
+// has by then, -1 if the agent hung up, or -2 if its reply is malformed.
+static int
+probe_agent(int fd, int msec)
+{
+    unsigned char buf[AGENT_MAX_MSGLEN];
+    unsigned char *o = buf + 4;
+    const unsigned char *end = buf + sizeof(buf);
+    struct timespec start, now;
+    int len, got = 0;
+
+    msg_put_byte(&o, end, SSH_AGENTC_EXTENSION);
+    msg_put_string(&o, end, EXTENSION_PING, strlen(EXTENSION_PING));
+    len = msg_finish(buf, o);
+    if (send(fd, buf, len, MSG_NOSIGNAL) != len)
+        return -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while ((len = msg_frame(buf, got)) == 0) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int elapsed;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed = (now.tv_sec - start.tv_sec) * 1000
+            + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (elapsed >= msec || poll(&pfd, 1, msec - elapsed) <= 0)
+            return 0;
+
+        len = recv(fd, buf + got, sizeof(buf) - got, 0);
+        if (len <= 0)
+            return -1;
+        got += len;
+    }
+    return len > 0 ? 1 : -2;
+}
+
+
+// Remove a stale socket path, unless it's no longer the file that was probed,
+// i.e. another instance has replaced it meanwhile.  Return 1 if it changed.
+static int
+unlink_stale_socket(const char *sockpath, const struct stat *probed)
+{
+    struct stat st;
+    if (stat(sockpath, &st) < 0)
+        return errno == ENOENT ? 0 : 1;
+    if (st.st_dev != probed->st_dev || st.st_ino != probed->st_ino)
+        return 1;
+    if (unlink(sockpath) < 0 && errno != ENOENT)
+        cleanup_warn("unlink");
+    return 0;
+}
+
+
+// Try to reuse an existing socket path, if the agent there answers a probe
+// request and belongs to this user, as anyone could have created a socket at
+// the default path in /tmp.  An agent that takes longer than timeout_msec may
+// just be waiting on a Pageant prompt, so it's still reused unless
+// replace_busy is set.  If it can't connect, or the agent is gone or wedged,
+// but the path is still a socket, try to remove it.  Return 0 if the path was
+// simply not connectible or has been cleared for a replacement, else exit.
+static int
+reuse_socket_path(const char* sockpath, int timeout_msec, int replace_busy,
+                  int quiet)
 {
     struct sockaddr_un addr;
-    int fd;
+    struct stat probed;
+    int fd, alive;
+
+retry:
+    if (stat(sockpath, &probed) < 0) {
+        if (errno == ENOENT)
+            return 0;
+        cleanup_warn(sockpath);
+    }
+    if (probed.st_uid != getuid())
+        errx(1, "%s is owned by another user, not reusing it", sockpath);
 
     fd = socket(PF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (fd < 0)
@@ -151,18 +429,54 @@ reuse_socket_path(const char* sockpath)
     addr.sun_family = AF_UNIX;
     strlcpy(addr.sun_path, sockpath, sizeof(addr.sun_path));
     if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
-        // The sockpath is already accepting connections -- reuse!
+#ifdef SO_PEERCRED
+        // The path may have been swapped since the stat, so also check who
+        // is actually listening.
+        struct ucred cred = { .pid = 0 };
+        socklen_t credlen = sizeof(cred);
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) < 0)
+            cred.pid = 0;
+        else if (cred.uid != getuid())
+            errx(1, "agent at %s belongs to another user, not reusing it",
+                 sockpath);
+#endif
+
+        // An agent that hangs up right away is most likely at its descriptor
+        // limit, shedding new connections, so it's busy rather than dead.
+        alive = probe_agent(fd, timeout_msec);
+        if (alive > 0 || alive == -1 || (alive == 0 && !replace_busy)) {
+            // The sockpath is already serving requests -- reuse!
+            if (alive == 0 && !quiet)
+                warnx("agent at %s is busy, reusing it anyway", sockpath);
+            else if (alive < 0 && !quiet)
+                warnx("agent at %s hung up, reusing it anyway", sockpath);
+            close(fd);
+            return 1;
+        }
+
+        // The agent answered with garbage, or never answered in time, e.g.
+        // because it's stuck in a Pageant request.  Ask it to exit, which it
+        // will do whenever it gets unstuck, and take over the path.
+#ifdef SO_PEERCRED
+        if (cred.pid > 0)
+            kill(cred.pid, SIGTERM);
+#endif
         close(fd);
-        return 1;
+        if (unlink_stale_socket(sockpath, &probed))
+            goto retry;
+        return 0;
     }
-    else if (errno == ENOENT)
+    else if (errno == ENOENT) {
+        close(fd);
         return 0;
+    }
     else if (errno == ECONNREFUSED) {
         // Either it's not listening, or not a socket at all.  If it was at
         // least a socket, remove it so it can be replaced.
+        close(fd);
         if (path_is_socket(sockpath)) {
-            if (unlink(sockpath) < 0)
-                cleanup_warn("unlink");
+            if (unlink_stale_socket(sockpath, &probed))
+                goto retry;
             return 0;
         }
 
@@ -177,6 +491,8 @@ static int
 agent_recv(int fd, struct fd_buf *p)
 {
     int len = recv(fd, p->buf + p->recv, sizeof(p->buf) - p->recv, 0);
+    if (len < 0 && io_retry())
+        return 0;
     if (len <= 0) {
         if (len < 0)
             warn("recv(%d)", fd);
@@ -184,17 +500,90 @@ agent_recv(int fd, struct fd_buf *p)
     }
 
     p->recv += len;
-    if (p->recv < 4 || p->recv < msglen(p->buf))
-        return 0;
+    len = msg_frame(p->buf, p->recv);
+    if (len <= 0) {
+        if (len < 0)
+            warnx("recv(%d): bad message length", fd);
+        return len;
+    }
 
-    if (p->recv > msglen(p->buf)) {
-        warnx("recv(%d) = %d (expected %d)",
-              fd, p->recv, msglen(p->buf));
+    // Connections that need the token must send it first, framed like an
+    // agent message.  It gets no reply; a wrong token just hangs up.  The
+    // first request may already have arrived right behind it.
+    if (p->need_token) {
+        if (!check_auth_token(p->buf + 4, len - 4)) {
+            warnx("recv(%d): bad token", fd);
+            return -1;
+        }
+        preauth_end(p);
+        p->recv -= len;
+        memmove(p->buf, p->buf + len, p->recv);
+        len = msg_frame(p->buf, p->recv);
+        if (len <= 0) {
+            if (len < 0)
+                warnx("recv(%d): bad message length", fd);
+            return len;
+        }
+    }
+
+    if (p->recv > len) {
+        warnx("recv(%d) = %d (expected %d)", fd, p->recv, len);
         return -1;
     }
 
-    agent_query(p->buf);
+    trace_record(p->id, TRACE_REQUEST, p->buf, len);
+    p->len = len;
+    return 1;
+}
+
+
+// Backend threads hand finished jobs back by writing the connection's
+// descriptor to its reactor's wake pipe.
+static void
+agent_job_done(struct backend_job *job)
+{
+    struct fd_buf *p = (struct fd_buf *)job;
+    if (write(p->reactor->wake[1], &p->fd, sizeof(p->fd)) != sizeof(p->fd))
+        cleanup_warn("write");
+}
+
+
+// Answer the request in p, returning 0 if it was queued for the backend
+// threads instead.  Reactors fed by the acceptor queue whatever needs
+// Pageant, so they go on serving their other connections meanwhile; the
+// connection is left out of polling until its reply comes back.
+static int
+agent_answer(struct fd_buf *p, int queue)
+{
+    if (agent_extension(p->buf, p->len))
+        return 1;
+    if (!queue) {
+        backend_query(p->buf, p->len);
+        return 1;
+    }
+
+    p->job.buf = p->buf;
+    p->job.len = p->len;
+    p->job.done = agent_job_done;
+    p->events = 0;
+    backend_submit(&p->job);
+    return 0;
+}
+
+
+// Get ready to send the reply that has replaced the request in p.
+static int
+agent_replied(int fd, struct fd_buf *p)
+{
+    // Replies are already well-framed; just note how much to send.
+    p->len = msg_frame(p->buf, sizeof(p->buf));
+    if (p->len < 0) {
+        warnx("recv(%d): bad reply length", fd);
+        return -1;
+    }
+    trace_record(p->id, TRACE_REPLY, p->buf, p->len);
     p->send = 0;
+    p->events = POLLOUT;
     return 1;
 }
 
@@ -202,19 +591,20 @@ agent_recv(int fd, struct fd_buf *p)
 static int
 agent_send(int fd, struct fd_buf *p)
 {
-    int len = send(fd, p->buf + p->send, msglen(p->buf) - p->send, 0);
+    int len = send(fd, p->buf + p->send, p->len - p->send, MSG_NOSIGNAL);
+    if (len < 0 && io_retry())
+        return 0;
     if (len < 0) {
         warn("send(%d)", fd);
         return -1;
     }
 
     p->send += len;
-    if (p->send < msglen(p->buf))
+    if (p->send < p->len)
         return 0;
 
-    if (p->send > msglen(p->buf)) {
-        warnx("send(%d) = %d (expected %d)",
-              fd, p->send, msglen(p->buf));
+    if (p->send > p->len) {
+        warnx("send(%d) = %d (expected %d)", fd, p->send, p->len);
         return -1;
     }
 
@@ -224,68 +614,288 @@ agent_send(int fd, struct fd_buf *p)
 
 
 static void
-do_agent_loop(int sockfd)
+reactor_close(struct reactor *r, int fd)
 {
-    int fd;
-    fd_set read_set, write_set;
-    struct fd_buf *bufs[FD_SETSIZE] = { NULL };
+    close(fd);
+    preauth_end(r->bufs[fd]);
+    free(r->bufs[fd]);
+    r->bufs[fd] = NULL;
+}
+
+
+// Close the oldest connection still awaiting its token.
+static void
+reactor_evict(struct reactor *r)
+{
+    int fd, oldest = -1;
+
+    for (fd = 0; fd < r->nbufs; ++fd)
+        if (r->bufs[fd] && r->bufs[fd]->need_token
+                && (oldest < 0
+                    || (int)(r->bufs[fd]->id - r->bufs[oldest]->id) < 0))
+            oldest = fd;
+    if (oldest >= 0) {
+        warnx("recv(%d): evicted while awaiting a token", oldest);
+        reactor_close(r, oldest);
+    }
+}
+
+
+// Take ownership of a newly accepted connection.
+static void
+reactor_add(struct reactor *r, int s, int need_token)
+{
+    static unsigned next_id = 0;
+
+    if (s >= r->nbufs) {
+        int n = r->nbufs ? r->nbufs : 64;
+        struct fd_buf **bufs;
+        while (n <= s)
+            n *= 2;
+        bufs = realloc(r->bufs, n * sizeof(*bufs));
+        if (!bufs) {
+            warnx("realloc: No memory");
+            close(s);
+            return;
+        }
+        memset(bufs + r->nbufs, 0, (n - r->nbufs) * sizeof(*bufs));
+        r->bufs = bufs;
+        r->nbufs = n;
+    }
+
+    // Idle connections mustn't lock out real clients, so make room by
+    // dropping the one that has been waiting for its token the longest.
+    if (need_token && r->npreauth >= PREAUTH_MAX)
+        reactor_evict(r);
+
+    r->bufs[s] = calloc(1, sizeof(struct fd_buf));
+    if (!r->bufs[s]) {
+        warnx("calloc: No memory");
+        close(s);
+    }
+    else {
+        r->bufs[s]->reactor = r;
+        r->bufs[s]->fd = s;
+        r->bufs[s]->id = __sync_fetch_and_add(&next_id, 1);
+        r->bufs[s]->need_token = need_token;
+        if (need_token) {
+            r->bufs[s]->token_deadline = monotonic_sec() + PREAUTH_SEC;
+            ++r->npreauth;
+        }
+        r->bufs[s]->events = POLLIN;
+    }
+}
 
-    FD_ZERO(&read_set);
-    FD_ZERO(&write_set);
-    FD_SET(sockfd, &read_set);
+
+// Accept a pending connection from a listener, as a non-blocking socket.
+static int
+accept_listener(const struct listener *l)
+{
+    int s = accept4(l->fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (s < 0 && (errno == EMFILE || errno == ENFILE) && spare_fd >= 0) {
+        // Out of descriptors: use the spare one to take the connection off
+        // the queue and hang up, so the listener doesn't stay readable.
+        warn("accept");
+        close(spare_fd);
+        s = accept(l->fd, NULL, NULL);
+        if (s >= 0)
+            close(s);
+        spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        errno = EAGAIN;
+        return -1;
+    }
+    if (s >= 0 && l->need_token) {
+        // Agent messages are small and latency-bound.
+        int on = 1;
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    return s;
+}
+
+
+// Fill in the poll set: the listeners, or the handoff and wake pipes, first,
+// then every connection that isn't waiting on the backend.  Returns its size.
+static int
+reactor_poll_set(struct reactor *r, const struct listener *ls, int nls)
+{
+    int fd, i, n = 0;
+
+    if (r->npfds < r->nbufs + nls + 2) {
+        struct pollfd *pfds;
+        int size = r->nbufs + nls + 2;
+        pfds = realloc(r->pfds, size * sizeof(*pfds));
+        if (!pfds)
+            cleanup_warn("realloc");
+        r->pfds = pfds;
+        r->npfds = size;
+    }
+
+    for (i = 0; i < nls; ++i)
+        r->pfds[n++] = (struct pollfd) { .fd = ls[i].fd, .events = POLLIN };
+    if (!nls) {
+        r->pfds[n++] = (struct pollfd) { .fd = r->handoff[0],
+                                         .events = POLLIN };
+        r->pfds[n++] = (struct pollfd) { .fd = r->wake[0], .events = POLLIN };
+    }
+
+    for (fd = 0; fd < r->nbufs; ++fd)
+        if (r->bufs[fd] && r->bufs[fd]->events)
+            r->pfds[n++] = (struct pollfd) {
+                .fd = fd, .events = r->bufs[fd]->events };
+    return n;
+}
+
+
+// Serve the connections owned by one reactor.  If listeners are given, this
+// reactor also accepts its own connections; otherwise they're handed off
+// through its pipe by the acceptor.
+static void
+reactor_run(struct reactor *r, const struct listener *ls, int nls)
+{
+    int fd, i, n;
 
     while (1) {
-        fd_set do_read_set = read_set;
-        fd_set do_write_set = write_set;
-        if (select(FD_SETSIZE, &do_read_set, &do_write_set, NULL, NULL) < 0)
-            cleanup_warn("select");
-
-        if (FD_ISSET(sockfd, &do_read_set)) {
-            int s = accept4(sockfd, NULL, NULL, SOCK_CLOEXEC);
-            if (s >= FD_SETSIZE) {
-                warnx("accept: Too many connections");
-                close(s);
+        // Wake up now and then to expire connections awaiting a token.
+        n = reactor_poll_set(r, ls, nls);
+        if (poll(r->pfds, n, r->npreauth ? 1000 : -1) < 0 && errno != EINTR)
+            cleanup_warn("poll");
+
+        for (i = 0; i < nls; ++i) {
+            if (r->pfds[i].revents & POLLIN) {
+                // Take the whole burst of pending connections at once.
+                int s;
+                while ((s = accept_listener(&ls[i])) >= 0)
+                    reactor_add(r, s, ls[i].need_token);
+                if (!io_retry())
+                    warn("accept");
             }
-            else if (s < 0)
-                warn("accept");
-            else {
-                bufs[s] = calloc(1, sizeof(struct fd_buf));
-                if (!bufs[s]) {
-                    warnx("calloc: No memory");
-                    close(s);
-                }
-                else
-                    FD_SET(s, &read_set);
+        }
+
+        if (!nls && r->pfds[0].revents) {
+            struct listener conns[64];
+            ssize_t j, len = read(r->handoff[0], conns, sizeof(conns));
+            if (len <= 0)
+                cleanup_warn("read");
+            for (j = 0; j < len / (ssize_t)sizeof(*conns); ++j)
+                reactor_add(r, conns[j].fd, conns[j].need_token);
+        }
+
+        if (!nls && r->pfds[1].revents) {
+            // Replies are usually sendable right away, so try before polling.
+            int fds[64];
+            ssize_t j, len = read(r->wake[0], fds, sizeof(fds));
+            if (len <= 0)
+                cleanup_warn("read");
+            for (j = 0; j < len / (ssize_t)sizeof(*fds); ++j) {
+                struct fd_buf *p = r->bufs[fds[j]];
+                int res = agent_replied(fds[j], p);
+                if (res > 0 && (res = agent_send(fds[j], p)) > 0)
+                    p->events = POLLIN;
+                if (res < 0)
+                    reactor_close(r, fds[j]);
             }
-            FD_CLR(sockfd, &do_read_set);
         }
 
-        FD_FOREACH(fd, &do_read_set) {
-            int res = agent_recv(fd, bufs[fd]);
-            if (res != 0) {
-                FD_CLR(fd, &read_set);
-                if (res < 0) {
-                    close(fd);
-                    free(bufs[fd]);
-                    bufs[fd] = NULL;
-                }
-                else
-                    FD_SET(fd, &write_set);
+        // Connections accepted just now come after n, so they're not looked
+        // at until the next poll.
+        for (i = nls ? nls : 2; i < n; ++i) {
+            struct fd_buf *p;
+            int res = 0;
+
+            fd = r->pfds[i].fd;
+            p = r->bufs[fd];
+            if (!r->pfds[i].revents)
+                continue;
+
+            if (p->events == POLLIN) {
+                res = agent_recv(fd, p);
+                if (res > 0 && agent_answer(p, !nls))
+                    res = agent_replied(fd, p);
             }
+            else if (p->events == POLLOUT) {
+                res = agent_send(fd, p);
+                if (res > 0)
+                    p->events = POLLIN;
+            }
+            if (res < 0)
+                reactor_close(r, fd);
         }
 
-        FD_FOREACH(fd, &do_write_set) {
-            int res = agent_send(fd, bufs[fd]);
-            if (res != 0) {
-                FD_CLR(fd, &write_set);
-                if (res < 0) {
-                    close(fd);
-                    free(bufs[fd]);
-                    bufs[fd] = NULL;
+        for (fd = 0; r->npreauth && fd < r->nbufs; ++fd) {
+            if (r->bufs[fd] && r->bufs[fd]->need_token
+                    && monotonic_sec() >= r->bufs[fd]->token_deadline) {
+                warnx("recv(%d): no token in time", fd);
+                reactor_close(r, fd);
+            }
+        }
+    }
+}
+
+
+static void *
+reactor_thread(void *arg)
+{
+    reactor_run(arg, NULL, 0);
+    return NULL;
+}
+
+
+// With multiple threads, the main thread only accepts connections and deals
+// them round-robin to the reactors, and the reactors queue requests for
+// Pageant to as many backend threads.  Those may query Pageant concurrently,
+// which is safe since the request mapping is named by thread id.
+static void
+do_agent_loop(const struct listener *ls, int nls, int nthreads, int debug)
+{
+    int i, next = 0;
+    struct pollfd pfds[nls];
+    struct reactor *reactors = calloc(nthreads, sizeof(struct reactor));
+    if (!reactors)
+        cleanup_warn("calloc");
+
+    spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    if (nthreads == 1)
+        reactor_run(&reactors[0], ls, nls);
+
+    if (backend_init(nthreads, debug) < 0)
+        cleanup_warn("pthread_create");
+
+    for (i = 0; i < nthreads; ++i) {
+        struct reactor *r = &reactors[i];
+        if (pipe2(r->handoff, O_CLOEXEC) < 0 || pipe2(r->wake, O_CLOEXEC) < 0)
+            cleanup_warn("pipe2");
+        errno = pthread_create(&r->thread, NULL, reactor_thread, r);
+        if (errno)
+            cleanup_warn("pthread_create");
+    }
+
+    for (i = 0; i < nls; ++i) {
+        pfds[i].fd = ls[i].fd;
+        pfds[i].events = POLLIN;
+    }
+
+    while (1) {
+        if (poll(pfds, nls, -1) < 0 && errno != EINTR)
+            cleanup_warn("poll");
+
+        for (i = 0; i < nls; ++i) {
+            // Pass the need for a token along with each connection, in one
+            // write so the handoff stays atomic.
+            struct listener conn = { .need_token = ls[i].need_token };
+            if (!(pfds[i].revents & POLLIN))
+                continue;
+
+            while ((conn.fd = accept_listener(&ls[i])) >= 0) {
+                struct reactor *r = &reactors[next];
+                next = (next + 1) % nthreads;
+                if (write(r->handoff[1], &conn, sizeof(conn)) != sizeof(conn)) {
+                    warn("write");
+                    close(conn.fd);
                 }
-                else
-                    FD_SET(fd, &read_set);
             }
+            if (!io_retry())
+                warn("accept");
         }
     }
 }
@@ -399,20 +1009,38 @@ main(int argc, char *argv[])
         { "help", no_argument, 0, 'h' },
         { "version", no_argument, 0, 'v' },
         { "reuse", no_argument, 0, 'r' },
+        { "reuse-timeout", required_argument, 0, 'W' },
+        { "threads", required_argument, 0, 'j' },
+        { "trace", required_argument, 0, 'T' },
+        { "replay", required_argument, 0, 'R' },
+        { "fast", no_argument, 0, 'F' },
+        { "sign-batch", no_argument, 0, 'B' },
+        { "tcp", required_argument, 0, 'P' },
+        { "token", required_argument, 0, 'K' },
         { 0, 0, 0, 0 }
     };
 
     int sockfd = -1;
+    struct listener listeners[2];
+    int nlisteners = 0;
 
     int opt;
     int opt_debug = 0;
     int opt_quiet = 0;
     int opt_kill = 0;
     int opt_reuse = 0;
+    int opt_reuse_timeout = 0;
     int opt_lifetime = 0;
+    int opt_threads = 1;
+    int opt_fast = 0;
+    int opt_sign_batch = 0;
+    int opt_tcp = 0;
+    struct sockaddr_in tcp_addr;
+    const char *opt_trace = NULL;
+    const char *opt_replay = NULL;
     shell_type opt_sh = get_shell_guess();
 
-    while ((opt = getopt_long(argc, argv, "+hvcsS:kdqa:rt:",
+    while ((opt = getopt_long(argc, argv, "+hvcsS:kdqa:rt:j:",
                               long_options, NULL)) != -1)
         switch (opt) {
             case 'h':
@@ -428,7 +1056,18 @@ main(int argc, char *argv[])
                 printf("  -q             Enable quiet mode.\n");
                 printf("  -a SOCKET      Create socket on a specific path.\n");
                 printf("  -r, --reuse    Allow to reuse an existing -a SOCKET.\n");
+                printf("  --reuse-timeout SECONDS\n");
+                printf("                 Replace a reused agent that doesn't answer in time.\n");
                 printf("  -t TIME        Limit key lifetime in seconds (not supported by Pageant).\n");
+                printf("  -j, --threads THREADS\n");
+                printf("                 Serve connections on several I/O threads.\n");
+                printf("  --trace FILE   Record the timing, type and size of agent messages.\n");
+                printf("  --replay FILE  Replay a recorded trace against SSH_AUTH_SOCK and exit.\n");
+                printf("  --fast         Replay as fast as possible, not with recorded timing.\n");
+                printf("  --sign-batch   Sign requests from stdin in batches, replies to stdout.\n");
+                printf("  --tcp [ADDR:]PORT\n");
+                printf("                 Also listen on TCP (default loopback), for VMs and containers.\n");
+                printf("  --token FILE   Read the token that --tcp clients must send first.\n");
                 return 0;
 
             case 'v':
@@ -479,6 +1118,44 @@ main(int argc, char *argv[])
                 opt_lifetime = 1;
                 break;
 
+            case 'j':
+                opt_threads = atoi(optarg);
+                if (opt_threads < 1 || opt_threads > MAX_THREADS)
+                    errx(1, "number of threads must be 1 to %d", MAX_THREADS);
+                break;
+
+            case 'W':
+                opt_reuse_timeout = atoi(optarg);
+                if (opt_reuse_timeout < 1 || opt_reuse_timeout > INT_MAX / 1000)
+                    errx(1, "invalid reuse timeout \"%s\"", optarg);
+                break;
+
+            case 'T':
+                opt_trace = optarg;
+                break;
+
+            case 'R':
+                opt_replay = optarg;
+                break;
+
+            case 'F':
+                opt_fast = 1;
+                break;
+
+            case 'B':
+                opt_sign_batch = 1;
+                break;
+
+            case 'P':
+                if (parse_tcp_address(optarg, &tcp_addr) < 0)
+                    errx(1, "invalid TCP address \"%s\"", optarg);
+                opt_tcp = 1;
+                break;
+
+            case 'K':
+                read_auth_token(optarg);
+                break;
+
             case '?':
                 errx(1, "try --help for more information");
                 break;
@@ -503,8 +1180,32 @@ main(int argc, char *argv[])
         return 0;
     }
 
-    if (opt_reuse && !sockpath[0])
-        errx(1, "socket reuse requires specifying -a SOCKET");
+    // Client modes talk to an existing agent rather than starting one.
+    if (opt_replay || opt_sign_batch) {
+        if (!sockpath[0]) {
+            const char *authsock = getenv("SSH_AUTH_SOCK");
+            if (!authsock)
+                errx(1, "SSH_AUTH_SOCK not set, cannot connect to agent");
+            strlcpy(sockpath, authsock, sizeof(sockpath));
+        }
+        if (opt_sign_batch)
+            return client_sign_batch(sockpath) < 0;
+        return trace_replay(opt_replay, sockpath, opt_fast) < 0;
+    }
+
+    // Without -a SOCKET, --reuse shares a per-user socket path, as the
+    // README suggests for ~/.bashrc.
+    if (opt_reuse && !sockpath[0]) {
+        const char *user = getenv("USERNAME") ?: getenv("USER");
+        if (!user)
+            errx(1, "socket reuse requires specifying -a SOCKET");
+        if ((size_t)snprintf(sockpath, sizeof(sockpath), "/tmp/.ssh-pageant-%s",
+                             user) >= sizeof(sockpath))
+            errx(1, "socket address is too long");
+    }
+
+    if (opt_tcp && !auth_token)
+        errx(1, "listening on TCP requires a --token FILE");
 
     if (opt_lifetime && !opt_quiet)
         warnx("option is not supported by Pageant -- t");
@@ -513,11 +1214,36 @@ main(int argc, char *argv[])
     signal(SIGHUP, cleanup_signal);
     signal(SIGTERM, cleanup_signal);
 
-    int p_sock_reused = opt_reuse && reuse_socket_path(sockpath);
-    if (!p_sock_reused) {
+    int p_sock_reused;
+    for (;;) {
+        p_sock_reused = opt_reuse
+            && reuse_socket_path(sockpath, opt_reuse_timeout
+                                     ? opt_reuse_timeout * 1000
+                                     : REUSE_PROBE_MSEC,
+                                 opt_reuse_timeout > 0, opt_quiet);
+        if (p_sock_reused)
+            break;
         if (!sockpath[0])
             create_socket_path(sockpath, sizeof(sockpath));
         sockfd = open_auth_socket(sockpath);
+        if (sockfd >= 0)
+            break;
+        if (!opt_reuse)
+            cleanup_warn("bind");
+
+        // Another instance bound the path since it was probed, so go back
+        // and reuse that one instead, once it has had a moment to listen.
+        usleep(10000);
+    }
+    if (p_sock_reused && opt_tcp && !opt_quiet)
+        warnx("reusing the agent at %s, so --tcp is ignored", sockpath);
+    if (!p_sock_reused) {
+        listeners[nlisteners++] = (struct listener) { sockfd, 0 };
+        if (opt_tcp)
+            listeners[nlisteners++] =
+                (struct listener) { open_tcp_socket(&tcp_addr), 1 };
+        if (opt_trace && trace_open(opt_trace) < 0)
+            cleanup_warn(opt_trace);
     }
 
     // If the sockpath is actually reused, don't daemonize, don't set
@@ -526,6 +1252,36 @@ main(int argc, char *argv[])
     int p_daemonize = !(opt_debug || p_sock_reused);
     int p_set_pid_env = !p_sock_reused;
 
+    // With --reuse, a command attaches to the shared agent rather than
+    // getting a private one.  Start that agent in the background if it isn't
+    // running yet, then simply become the command.
+    if (optind < argc && opt_reuse) {
+        char *const *subargv = argv + optind;
+        if (!p_sock_reused) {
+            pid_t pid = fork();
+            if (pid < 0)
+                cleanup_warn("fork");
+            if (pid == 0) {
+                if (setsid() < 0)
+                    cleanup_warn("setsid");
+                fclose(stdin);
+                fclose(stdout);
+                // With -d, keep reporting on the caller's stderr.
+                if (!opt_debug)
+                    fclose(stderr);
+                do_agent_loop(listeners, nlisteners, opt_threads, opt_debug);
+            }
+
+            // The sockets belong to the background agent now.
+            while (nlisteners > 0)
+                close(listeners[--nlisteners].fd);
+            cleanup_sockpath[0] = '\0';
+        }
+        setenv("SSH_AUTH_SOCK", sockpath, 1);
+        execvp(subargv[0], subargv);
+        err(1, "%s", subargv[0]);
+    }
+
     if (optind < argc) {
         const char **subargv = (const char **)argv + optind;
         setenv("SSH_AUTH_SOCK", sockpath, 1);
@@ -562,7 +1318,7 @@ main(int argc, char *argv[])
     fclose(stdout);
 
     if (!p_sock_reused)
-        do_agent_loop(sockfd);
+        do_agent_loop(listeners, nlisteners, opt_threads, opt_debug);
 
     return 0;
 }
@@ -0,0 +1,181 @@
+/*
+ * ssh-pageant agent protocol parsing.
+ * Copyright (C) 2026  Josh Stone
+ *
+ * This file is part of ssh-pageant, and is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General
+ * Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ */
+
+#include <string.h>
+
+#include "protocol.h"
+
+// All of these return 0 on success or -1 if the data would run past the end,
+// in which case the view or output position is left where it was.
+
+
+uint32_t
+msg_load_u32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16
+        | (uint32_t)p[2] << 8 | p[3];
+}
+
+
+void
+msg_store_u32(unsigned char *p, uint32_t val)
+{
+    p[0] = val >> 24;
+    p[1] = val >> 16;
+    p[2] = val >> 8;
+    p[3] = val;
+}
+
+
+int
+msg_frame(const void *buf, int got)
+{
+    uint32_t len;
+    if (got < 4)
+        return 0;
+    len = msg_load_u32(buf);
+    if (len < 1 || len > AGENT_MAX_MSGLEN - 4)
+        return -1;
+    return got < (int)(4 + len) ? 0 : (int)(4 + len);
+}
+
+
+int
+msg_open(struct msg_view *v, const void *buf, int len)
+{
+    const unsigned char *p = buf;
+    len = msg_frame(buf, len);
+    if (len <= 0)
+        return -1;
+    v->p = p + 5;
+    v->end = p + len;
+    return p[4];
+}
+
+
+int
+msg_get_byte(struct msg_view *v, unsigned char *val)
+{
+    if (v->p == v->end)
+        return -1;
+    *val = *v->p++;
+    return 0;
+}
+
+
+int
+msg_get_u32(struct msg_view *v, uint32_t *val)
+{
+    if (v->end - v->p < 4)
+        return -1;
+    *val = msg_load_u32(v->p);
+    v->p += 4;
+    return 0;
+}
+
+
+int
+msg_get_string(struct msg_view *v, struct msg_blob *str)
+{
+    uint32_t len;
+    if (v->end - v->p < 4)
+        return -1;
+    len = msg_load_u32(v->p);
+    if ((uint32_t)(v->end - v->p - 4) < len)
+        return -1;
+    str->p = v->p + 4;
+    str->len = len;
+    v->p += 4 + len;
+    return 0;
+}
+
+
+int
+msg_blob_eq(const struct msg_blob *str, const char *s)
+{
+    return str->len == strlen(s) && !memcmp(str->p, s, str->len);
+}
+
+
+int
+msg_get_identities(struct msg_view *v, uint32_t *nkeys)
+{
+    return msg_get_u32(v, nkeys);
+}
+
+
+int
+msg_next_identity(struct msg_view *v,
+                  struct msg_blob *key, struct msg_blob *comment)
+{
+    struct msg_view w = *v;
+    if (msg_get_string(&w, key) < 0 || msg_get_string(&w, comment) < 0)
+        return -1;
+    *v = w;
+    return 0;
+}
+
+
+int
+msg_get_sign_request(struct msg_view *v, struct msg_sign_request *req)
+{
+    struct msg_view w = *v;
+    if (msg_get_string(&w, &req->key) < 0
+            || msg_get_string(&w, &req->data) < 0
+            || msg_get_u32(&w, &req->flags) < 0)
+        return -1;
+    *v = w;
+    return 0;
+}
+
+
+int
+msg_put_byte(unsigned char **out, const unsigned char *end, unsigned char val)
+{
+    if (*out == end)
+        return -1;
+    *(*out)++ = val;
+    return 0;
+}
+
+
+int
+msg_put_u32(unsigned char **out, const unsigned char *end, uint32_t val)
+{
+    if (end - *out < 4)
+        return -1;
+    msg_store_u32(*out, val);
+    *out += 4;
+    return 0;
+}
+
+
+int
+msg_put_string(unsigned char **out, const unsigned char *end,
+               const void *str, uint32_t len)
+{
+    if (end - *out < 4 || (uint32_t)(end - *out - 4) < len)
+        return -1;
+    msg_store_u32(*out, len);
+    memcpy(*out + 4, str, len);
+    *out += 4 + len;
+    return 0;
+}
+
+
+int
+msg_finish(void *buf, const unsigned char *out)
+{
+    unsigned char *p = buf;
+    if (out - p < 5)
+        return -1;
+    msg_store_u32(p, out - p - 4);
+    return out - p;
+}
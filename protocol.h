@@ -0,0 +1,79 @@
+/*
+ * ssh-pageant agent protocol header.
+ * Copyright (C) 2026  Josh Stone
+ *
+ * This file is part of ssh-pageant, and is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General
+ * Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ */
+
+#ifndef __PROTOCOL_H__
+#define __PROTOCOL_H__
+
+#include "winpgntc.h"
+
+#define SSH_AGENT_FAILURE               5
+#define SSH_AGENT_SUCCESS               6
+#define SSH_AGENTC_REQUEST_IDENTITIES   11
+#define SSH_AGENT_IDENTITIES_ANSWER     12
+#define SSH2_AGENTC_SIGN_REQUEST        13
+#define SSH_AGENT_SIGN_RESPONSE         14
+#define SSH_AGENTC_EXTENSION            27
+#define SSH_AGENT_EXTENSION_FAILURE     28
+
+// A bounds-checked view of the part of a message not parsed yet.  Views
+// never copy or allocate; strings point back into the message itself.
+struct msg_view {
+    const unsigned char *p, *end;
+};
+
+struct msg_blob {
+    const unsigned char *p;
+    uint32_t len;
+};
+
+struct msg_sign_request {
+    struct msg_blob key, data;
+    uint32_t flags;
+};
+
+// Read or write a big-endian uint32 at p, which needn't be aligned.
+extern uint32_t msg_load_u32(const unsigned char *p);
+extern void msg_store_u32(unsigned char *p, uint32_t val);
+
+// Check how much of a message has arrived in the first got bytes of buf.
+// Returns the full length with its prefix once complete, 0 if more is
+// needed, or -1 if the message is empty or can't fit in AGENT_MAX_MSGLEN.
+extern int msg_frame(const void *buf, int got);
+
+// Start a view over the message at the start of the first len bytes of buf,
+// and return its type, or -1 if it isn't a complete, well-framed message.
+extern int msg_open(struct msg_view *v, const void *buf, int len);
+
+extern int msg_get_byte(struct msg_view *v, unsigned char *val);
+extern int msg_get_u32(struct msg_view *v, uint32_t *val);
+extern int msg_get_string(struct msg_view *v, struct msg_blob *str);
+extern int msg_blob_eq(const struct msg_blob *str, const char *s);
+
+// Walk an SSH_AGENT_IDENTITIES_ANSWER: first the count, then each key.
+extern int msg_get_identities(struct msg_view *v, uint32_t *nkeys);
+extern int msg_next_identity(struct msg_view *v,
+                             struct msg_blob *key, struct msg_blob *comment);
+
+// Read the fields of an SSH2_AGENTC_SIGN_REQUEST.
+extern int msg_get_sign_request(struct msg_view *v,
+                                struct msg_sign_request *req);
+
+// Append to a message being built at *out, stopping short of end.
+extern int msg_put_byte(unsigned char **out, const unsigned char *end,
+                        unsigned char val);
+extern int msg_put_u32(unsigned char **out, const unsigned char *end,
+                       uint32_t val);
+extern int msg_put_string(unsigned char **out, const unsigned char *end,
+                          const void *str, uint32_t len);
+
+// Fill in the length prefix of a message built up to out.
+extern int msg_finish(void *buf, const unsigned char *out);
+
+#endif /* __PROTOCOL_H__ */
@@ -0,0 +1,435 @@
+/*
+ * ssh-pageant traffic trace recording and replay.
+ * Copyright (C) 2026  Josh Stone
+ *
+ * This file is part of ssh-pageant, and is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General
+ * Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ */
+
+#include "compat.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "client.h"
+#include "protocol.h"
+#include "trace.h"
+
+// A trace is this magic header followed by fixed-size records, all in
+// network byte order:
+//
+//   uint32 sec, uint32 usec   time since the trace started
+//   uint32 conn               connection id, unique for the daemon's life
+//   uint32 len                message length, without the length prefix
+//   byte dir                  TRACE_REQUEST or TRACE_REPLY
+//   byte type                 agent message type
+//   byte[2] reserved
+static const char trace_magic[8] = "SPTRACE\1";
+#define TRACE_RECORD_SIZE 20
+
+struct record {
+    unsigned long long usec;
+    uint32_t conn, len;
+    unsigned char dir, type;
+};
+
+struct conn_order {
+    uint32_t conn;
+    int index;
+};
+
+struct conn {
+    int fd, last, current, pending;
+    uint32_t recv, need;
+    unsigned char head[4];
+};
+
+
+static FILE *trace_file = NULL;
+static struct timespec trace_start;
+
+
+static unsigned long long
+elapsed_usec(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000ULL
+        + now.tv_nsec / 1000 - start->tv_nsec / 1000;
+}
+
+
+int
+trace_open(const char *path)
+{
+    trace_file = fopen(path, "wbe");
+    if (!trace_file)
+        return -1;
+    clock_gettime(CLOCK_MONOTONIC, &trace_start);
+
+    // Flush the header now, or a daemon forked later would write it again
+    // along with its parent.
+    if (fwrite(trace_magic, sizeof(trace_magic), 1, trace_file) != 1
+            || fflush(trace_file) != 0) {
+        fclose(trace_file);
+        trace_file = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+
+void
+trace_record(unsigned conn, int dir, const void *msg, int len)
+{
+    unsigned char rec[TRACE_RECORD_SIZE] = { 0 };
+    unsigned long long usec;
+
+    if (!trace_file)
+        return;
+
+    usec = elapsed_usec(&trace_start);
+    msg_store_u32(rec, usec / 1000000);
+    msg_store_u32(rec + 4, usec % 1000000);
+    msg_store_u32(rec + 8, conn);
+    msg_store_u32(rec + 12, len - 4);
+    rec[16] = dir;
+    rec[17] = len > 4 ? ((const unsigned char *)msg)[4] : 0;
+
+    // A single fwrite is atomic with respect to the other I/O threads.
+    fwrite(rec, sizeof(rec), 1, trace_file);
+}
+
+
+static int
+compare_conn_order(const void *a, const void *b)
+{
+    const struct conn_order *x = a, *y = b;
+    if (x->conn != y->conn)
+        return x->conn < y->conn ? -1 : 1;
+    return x->index - y->index;
+}
+
+
+// Number the connections of a trace densely from zero, so they can index
+// an array however large the recorded ids were.  Returns the number of
+// distinct connections, or -1.
+static int
+renumber_conns(struct record *recs, int n)
+{
+    struct conn_order *order;
+    int i, nconns = 0;
+
+    order = malloc((n ? n : 1) * sizeof(*order));
+    if (!order) {
+        warnx("malloc: No memory");
+        return -1;
+    }
+    for (i = 0; i < n; ++i) {
+        order[i].conn = recs[i].conn;
+        order[i].index = i;
+    }
+    qsort(order, n, sizeof(*order), compare_conn_order);
+
+    for (i = 0; i < n; ++i) {
+        if (i > 0 && order[i].conn != order[i - 1].conn)
+            ++nconns;
+        recs[order[i].index].conn = nconns;
+    }
+
+    free(order);
+    return n ? nconns + 1 : 0;
+}
+
+
+// Read all the records of a trace file.  Caller must free the result.
+static struct record *
+load_trace(const char *path, int *count)
+{
+    unsigned char rec[TRACE_RECORD_SIZE];
+    char magic[sizeof(trace_magic)];
+    struct record *recs = NULL;
+    int n = 0, size = 0;
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        warn("%s", path);
+        return NULL;
+    }
+
+    if (fread(magic, sizeof(magic), 1, f) != 1
+            || memcmp(magic, trace_magic, sizeof(magic))) {
+        warnx("%s: not an ssh-pageant trace", path);
+        fclose(f);
+        return NULL;
+    }
+
+    while (fread(rec, sizeof(rec), 1, f) == 1) {
+        if (n == size) {
+            struct record *more;
+            size = size ? 2 * size : 1024;
+            more = realloc(recs, size * sizeof(*recs));
+            if (!more) {
+                warnx("realloc: No memory");
+                free(recs);
+                fclose(f);
+                return NULL;
+            }
+            recs = more;
+        }
+        recs[n].usec = msg_load_u32(rec) * 1000000ULL + msg_load_u32(rec + 4);
+        recs[n].conn = msg_load_u32(rec + 8);
+        recs[n].len = msg_load_u32(rec + 12);
+        recs[n].dir = rec[16];
+        recs[n].type = rec[17];
+        ++n;
+    }
+
+    fclose(f);
+    if (!n)
+        warnx("%s: empty trace", path);
+    *count = n;
+    return recs;
+}
+
+
+// Find a real key blob to sign with, so replayed sign requests cost the
+// agent about as much as the recorded ones did.
+static uint32_t
+first_key(const char *sockpath, unsigned char *key)
+{
+    unsigned char buf[AGENT_MAX_MSGLEN];
+    static const char query[5] = { 0, 0, 0, 1, SSH_AGENTC_REQUEST_IDENTITIES };
+    struct msg_view v;
+    struct msg_blob blob, comment;
+    uint32_t nkeys;
+    int len = -1;
+
+    int fd = client_connect(sockpath);
+    if (fd < 0)
+        return 0;
+
+    if (client_send(fd, query, sizeof(query)) == 0)
+        len = client_recv(fd, buf);
+    close(fd);
+
+    if (msg_open(&v, buf, len) != SSH_AGENT_IDENTITIES_ANSWER
+            || msg_get_identities(&v, &nkeys) < 0 || nkeys < 1
+            || msg_next_identity(&v, &blob, &comment) < 0
+            || blob.len > AGENT_MAX_MSGLEN / 2)
+        return 0;
+
+    memcpy(key, blob.p, blob.len);
+    return blob.len;
+}
+
+
+// Build a stand-in for a recorded request with the same type and size.
+// Sign requests use the given key with zeroed data, others are zero-filled.
+static int
+synthesize(unsigned char *buf, const struct record *r,
+           const unsigned char *key, uint32_t keylen)
+{
+    const unsigned char *end = buf + AGENT_MAX_MSGLEN;
+    unsigned char *o = buf + 5;
+    uint32_t len = r->len;
+    if (len < 1)
+        len = 1;
+    if (len > AGENT_MAX_MSGLEN - 4)
+        len = AGENT_MAX_MSGLEN - 4;
+
+    memset(buf, 0, 4 + len);
+    buf[4] = r->type;
+
+    if (r->type == SSH2_AGENTC_SIGN_REQUEST && keylen > 0) {
+        // byte type, string key, string data, uint32 flags
+        uint32_t datalen = 0;
+        if (len > 1 + 4 + keylen + 4 + 4)
+            datalen = len - (1 + 4 + keylen + 4 + 4);
+        msg_put_string(&o, end, key, keylen);
+        msg_put_u32(&o, end, datalen);
+        o += datalen;
+        msg_put_u32(&o, end, 0);
+        return msg_finish(buf, o);
+    }
+
+    return msg_finish(buf, buf + 4 + len);
+}
+
+
+// Wait up to timeout microseconds (or forever if negative) for replies,
+// and consume whatever arrives.  Returns the number of replies completed.
+// Only the npending connections listed in pending are polled, with one pfds
+// entry each, and those completed are dropped from the list.
+static int
+service(struct conn *conns, uint32_t *pending, int *npending,
+        struct pollfd *pfds, long long timeout)
+{
+    unsigned char scratch[AGENT_MAX_MSGLEN];
+    int i, kept = 0, msec = -1, done = 0;
+
+    for (i = 0; i < *npending; ++i) {
+        pfds[i].fd = conns[pending[i]].fd;
+        pfds[i].events = POLLIN;
+        pfds[i].revents = 0;
+    }
+
+    // Round up, so a request is never sent before it's due.
+    if (timeout >= 0)
+        msec = timeout / 1000 < INT_MAX ? (timeout + 999) / 1000 : INT_MAX;
+
+    if (poll(pfds, *npending, msec) < 0) {
+        warn("poll");
+        return -1;
+    }
+
+    for (i = 0; i < *npending; ++i) {
+        struct conn *c = &conns[pending[i]];
+        ssize_t n;
+        if (!pfds[i].revents) {
+            pending[kept++] = pending[i];
+            continue;
+        }
+
+        // Read the length prefix first, then just discard the body.
+        n = recv(c->fd, scratch, c->recv < 4 ? 4 - c->recv
+                 : c->need - c->recv < sizeof(scratch)
+                 ? c->need - c->recv : sizeof(scratch), 0);
+        if (n <= 0) {
+            warnx("replay: connection %u closed by agent",
+                  (unsigned)pending[i]);
+            return -1;
+        }
+        if (c->recv < 4) {
+            memcpy(c->head + c->recv, scratch, n);
+            c->recv += n;
+            if (c->recv == 4)
+                c->need = 4 + msg_load_u32(c->head);
+        }
+        else
+            c->recv += n;
+
+        if (c->recv < 4 || c->recv < c->need) {
+            pending[kept++] = pending[i];
+            continue;
+        }
+
+        c->pending = 0;
+        ++done;
+
+        // Close each connection as soon as its last reply has arrived.
+        if (c->current == c->last) {
+            close(c->fd);
+            c->fd = -1;
+        }
+    }
+    *npending = kept;
+    return done;
+}
+
+
+int
+trace_replay(const char *path, const char *sockpath, int fast)
+{
+    unsigned char buf[AGENT_MAX_MSGLEN];
+    unsigned char key[AGENT_MAX_MSGLEN / 2];
+    struct conn *conns = NULL;
+    struct pollfd *pfds = NULL;
+    uint32_t *pending = NULL;
+    struct record *recs;
+    struct timespec start;
+    uint32_t keylen, nconns;
+    int i, n, res = -1, requests = 0, npending = 0;
+
+    recs = load_trace(path, &n);
+    if (!recs)
+        return -1;
+
+    if ((i = renumber_conns(recs, n)) < 0)
+        goto out;
+    nconns = i;
+    conns = calloc(nconns ? nconns : 1, sizeof(*conns));
+    pfds = calloc(nconns ? nconns : 1, sizeof(*pfds));
+    pending = calloc(nconns ? nconns : 1, sizeof(*pending));
+    if (!conns || !pfds || !pending) {
+        warnx("calloc: No memory");
+        goto out;
+    }
+    for (i = 0; i < (int)nconns; ++i)
+        conns[i].fd = -1;
+    for (i = 0; i < n; ++i)
+        if (recs[i].dir == TRACE_REQUEST)
+            conns[recs[i].conn].last = i;
+
+    keylen = first_key(sockpath, key);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < n; ++i) {
+        const struct record *r = &recs[i];
+        struct conn *c = &conns[r->conn];
+        if (r->dir != TRACE_REQUEST)
+            continue;
+
+        // Keep collecting replies until this request is due and its
+        // connection is free for another request.
+        while (c->pending || (!fast && r->usec > elapsed_usec(&start))) {
+            long long wait = -1;
+            if (!c->pending) {
+                wait = r->usec - elapsed_usec(&start);
+                if (wait < 0)
+                    wait = 0;
+            }
+            if (service(conns, pending, &npending, pfds, wait) < 0)
+                goto out;
+        }
+
+        // A storm of short connections can outrun the descriptor limit,
+        // so wait for outstanding replies to close some first.
+        while (c->fd < 0 && (c->fd = client_connect(sockpath)) < 0) {
+            if ((errno != EMFILE && errno != ENFILE) || !npending) {
+                warn("connect(%s)", sockpath);
+                goto out;
+            }
+            if (service(conns, pending, &npending, pfds, -1) < 0)
+                goto out;
+        }
+
+        if (client_send(c->fd, buf, synthesize(buf, r, key, keylen)) < 0) {
+            warn("send");
+            goto out;
+        }
+        c->pending = 1;
+        c->recv = c->need = 0;
+        c->current = i;
+        pending[npending++] = r->conn;
+        ++requests;
+    }
+
+    while (npending > 0)
+        if (service(conns, pending, &npending, pfds, -1) < 0)
+            goto out;
+
+    printf("replayed %d requests in %.3f seconds\n",
+           requests, elapsed_usec(&start) / 1e6);
+    res = 0;
+
+out:
+    if (conns)
+        for (i = 0; i < (int)nconns; ++i)
+            if (conns[i].fd >= 0)
+                close(conns[i].fd);
+    free(pending);
+    free(pfds);
+    free(conns);
+    free(recs);
+    return res;
+}
@@ -0,0 +1,28 @@
+/*
+ * ssh-pageant traffic trace header.
+ * Copyright (C) 2026  Josh Stone
+ *
+ * This file is part of ssh-pageant, and is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General
+ * Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#define TRACE_REQUEST  0
+#define TRACE_REPLY    1
+
+// Start recording agent traffic to the given path.
+extern int trace_open(const char *path);
+
+// Record one complete agent message of len bytes from a connection, if
+// tracing.  Only the timing, type and size are kept, never the contents.
+extern void trace_record(unsigned conn, int dir, const void *msg, int len);
+
+// Drive the requests of a recorded trace against the agent at sockpath,
+// either with their original timing or as fast as possible.
+extern int trace_replay(const char *path, const char *sockpath, int fast);
+
+#endif /* __TRACE_H__ */
@@ -11,16 +11,16 @@
  * license is available in COPYING.PuTTY.
  */
 
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <windows.h>
 
+#include "protocol.h"
 #include "winpgntc.h"
 
 #define AGENT_COPYDATA_ID 0x804e50ba   /* random goop */
 
-#define SSH_AGENT_FAILURE 5
-
 static PSID
 get_user_sid(void)
 {
@@ -55,31 +55,46 @@ get_user_sid(void)
     return ret;
 }
 
-void
+static SECURITY_ATTRIBUTES mapping_sa, *mapping_psa = NULL;
+static pthread_once_t mapping_once = PTHREAD_ONCE_INIT;
+
+/* The user's SID doesn't change, so build the security attributes for the
+ * request mappings once and share them with every query on every thread. */
+static void
+init_mapping_sa(void)
+{
+    PSECURITY_DESCRIPTOR psd = NULL;
+    PSID usersid = get_user_sid();
+    if (usersid) {
+        psd = (PSECURITY_DESCRIPTOR)
+            LocalAlloc(LPTR, SECURITY_DESCRIPTOR_MIN_LENGTH);
+        if (psd) {
+            if (InitializeSecurityDescriptor
+                    (psd, SECURITY_DESCRIPTOR_REVISION)
+                    && SetSecurityDescriptorOwner(psd, usersid, FALSE)) {
+                mapping_sa.nLength = sizeof(mapping_sa);
+                mapping_sa.bInheritHandle = TRUE;
+                mapping_sa.lpSecurityDescriptor = psd;
+                mapping_psa = &mapping_sa;
+                return;
+            }
+            LocalFree(psd);
+        }
+        free(usersid);
+    }
+}
+
+int
 agent_query(void *buf)
 {
     HWND hwnd = FindWindow("Pageant", "Pageant");
-    if (hwnd) {
+    int len = msg_frame(buf, AGENT_MAX_MSGLEN);
+    if (hwnd && len > 0) {
         char mapname[] = "PageantRequest12345678";
         sprintf(mapname, "PageantRequest%08x", (unsigned)GetCurrentThreadId());
 
-        PSECURITY_DESCRIPTOR psd = NULL;
-        SECURITY_ATTRIBUTES sa, *psa = NULL;
-        PSID usersid = get_user_sid();
-        if (usersid) {
-            psd = (PSECURITY_DESCRIPTOR)
-                LocalAlloc(LPTR, SECURITY_DESCRIPTOR_MIN_LENGTH);
-            if (psd) {
-                if (InitializeSecurityDescriptor
-                        (psd, SECURITY_DESCRIPTOR_REVISION)
-                        && SetSecurityDescriptorOwner(psd, usersid, FALSE)) {
-                    sa.nLength = sizeof(sa);
-                    sa.bInheritHandle = TRUE;
-                    sa.lpSecurityDescriptor = psd;
-                    psa = &sa;
-                }
-            }
-        }
+        pthread_once(&mapping_once, init_mapping_sa);
+        SECURITY_ATTRIBUTES *psa = mapping_psa;
 
         HANDLE filemap = CreateFileMapping(INVALID_HANDLE_VALUE, psa,
                                            PAGE_READWRITE, 0,
@@ -87,7 +102,7 @@ agent_query(void *buf)
 
         if (filemap != NULL && filemap != INVALID_HANDLE_VALUE) {
             void *p = MapViewOfFile(filemap, FILE_MAP_WRITE, 0, 0, 0);
-            memcpy(p, buf, msglen(buf));
+            memcpy(p, buf, len);
 
             COPYDATASTRUCT cds = {
                 .dwData = AGENT_COPYDATA_ID,
@@ -98,25 +113,23 @@ agent_query(void *buf)
             int id = SendMessage(hwnd, WM_COPYDATA,
                                  (WPARAM) NULL, (LPARAM) &cds);
 
-            if (msglen(p) > AGENT_MAX_MSGLEN)
+            /* Read the reply length from the shared mapping only once. */
+            len = msg_frame(p, AGENT_MAX_MSGLEN);
+            if (len <= 0)
                 id = 0;
 
             if (id > 0)
-                memcpy(buf, p, msglen(p));
+                memcpy(buf, p, len);
 
             UnmapViewOfFile(p);
             CloseHandle(filemap);
-            LocalFree(psd);
-            free(usersid);
 
             if (id > 0)
-                return;
+                return 0;
         }
-
-        LocalFree(psd);
-        free(usersid);
     }
 
     static const char reply_error[5] = { 0, 0, 0, 1, SSH_AGENT_FAILURE };
-    memcpy(buf, reply_error, msglen(reply_error));
+    memcpy(buf, reply_error, sizeof(reply_error));
+    return -1;
 }
@@ -21,10 +21,8 @@
 typedef unsigned long uint32_t;
 #endif // defined(__MSYS__) && !defined(__NEWLIB__)
 
-extern void agent_query(void *buf);
-
-static inline int msglen(const void *p) {
-    return 4 + ntohl(*(const uint32_t *)p);
-}
+// Query Pageant, replacing the request in buf with its reply.  Returns -1
+// if Pageant couldn't be reached, leaving a generic failure reply in buf.
+extern int agent_query(void *buf);
 
 #endif /* __WINPGNTC_H__ */